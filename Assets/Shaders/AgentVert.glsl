@@ -12,6 +12,7 @@ uniform mat4 projMatrix 	= mat4(1.0f);
 
 uniform bool visualiseGrid = false;
 uniform float bound = 50;
+uniform float interpolation = 1.0;
 
 layout(location = 0) in vec3 position;
 layout(location = 1) in vec4 colour;
@@ -22,6 +23,11 @@ layout(std430, binding = 0) buffer agentBuffer {
 	Agent agents[];
 };
 
+// The same agents before the latest simulation step
+layout(std430, binding = 4) buffer previousAgentBuffer {
+	Agent previousAgents[];
+};
+
 out Vertex
 {
 	vec4 colour;
@@ -124,9 +130,21 @@ void main(void)
 {
 	Agent agent = agents[gl_InstanceID];
 
+	Agent previous = previousAgents[gl_InstanceID];
+
 	vec3 pos = vec3(agent.pos[0], agent.pos[1], agent.pos[2]);
 	vec3 vel = vec3(agent.vel[0], agent.vel[1], agent.vel[2]);
 
+	// Agents that wrapped around the bounds jump rather than sweep across the flock
+	vec3 previousPos = vec3(previous.pos[0], previous.pos[1], previous.pos[2]);
+	if (distance(previousPos, pos) < bound) {
+		vec3 previousVel = vec3(previous.vel[0], previous.vel[1], previous.vel[2]);
+		vec3 blendedVel = mix(previousVel, vel, interpolation);
+
+		pos = mix(previousPos, pos, interpolation);
+		vel = length(blendedVel) > 0.0001 ? blendedVel : vel;
+	}
+
 	mat4 modelMatrix  = getTranslationMat(pos) * getRotationMat(vel) * scaleMat;
 	mat3 normalMatrix = transpose(inverse(mat3(modelMatrix)));
 	mat4 mvp 		  = (projMatrix * viewMatrix * modelMatrix);
@@ -18,6 +18,17 @@ layout(std430, binding = 1) buffer indexBuffer
     uint indices[];
 };
 
+// xyz = gradient, w = signed distance
+layout(std430, binding = 2) buffer obstacleBuffer
+{
+    vec4 obstacleField[];
+};
+
+layout(std430, binding = 3) buffer counterBuffer
+{
+    uint fovRejected;
+};
+
 layout(location = 1) uniform uint size;
 layout(location = 2) uniform float dt;
 layout(location = 3) uniform float bound;
@@ -38,10 +49,23 @@ layout(location = 10) uniform vec3 avLineEnd;
 layout(location = 11) uniform uint cellsPerAxis;
 layout(location = 12) uniform float cellDimensionReciprocal;
 
+// 0 = no obstacles
+layout(location = 13) uniform int obstacleResolution;
+layout(location = 14) uniform float obstacleRange;
+layout(location = 15) uniform float obstacleWeight;
+
+// 0 = wrap, 1 = contain
+layout(location = 16) uniform int boundaryMode;
+layout(location = 17) uniform float containMargin;
+
+// x = alignment, y = separation, z = cohesion, each cos(fov / 2) stored as c|c|
+layout(location = 18) uniform vec3 viewThresholds;
+
 vec3 align = vec3(0);
 vec3 separate = vec3(0);
 vec3 cohese = vec3(0);
 int neighbours;
+uint rejected;
 
 void wrap(inout float curPos[3]) {
     if (curPos[0] < -bound)
@@ -72,6 +96,23 @@ void wrap(inout float curPos[3]) {
     }
 }
 
+void clampBounds(inout float curPos[3]) {
+    curPos[0] = clamp(curPos[0], -bound, bound);
+    curPos[1] = clamp(curPos[1], -bound, bound);
+    curPos[2] = clamp(curPos[2], -bound, bound);
+}
+
+// Quadratic ramp from the inner edge of the margin to maxAngle at each wall, matching SimulationCPU::ContainBounds
+// A margin of 0 leaves only the clamp at the walls
+vec3 contain(vec3 pos) {
+    if (containMargin <= 0.0)
+        return vec3(0);
+    float inner = bound - containMargin;
+    vec3 nearMin = clamp((vec3(-inner) - pos) / containMargin, 0.0, 1.0);
+    vec3 nearMax = clamp((pos - vec3(inner)) / containMargin, 0.0, 1.0);
+    return (nearMin * nearMin - nearMax * nearMax) * maxAngle;
+}
+
 vec3 steer(vec3 desired, vec3 velocity) {
     vec3 steer = normalize(desired) * maxVel - velocity;
     steer = clamp(steer, vec3(-maxAngle), vec3(maxAngle));
@@ -100,6 +141,31 @@ vec3 interactWithRay(vec3 bPos) {
     return vec3(0);
 }
 
+vec4 obstacleSample(int x, int y, int z) {
+    return obstacleField[x + y * obstacleResolution + z * obstacleResolution * obstacleResolution];
+}
+
+vec3 avoidObstacles(vec3 pos, vec3 vel) {
+    if (obstacleResolution == 0)
+        return vec3(0);
+
+    float limit = float(obstacleResolution) - 1.001;
+    vec3 f = clamp((pos + bound) * ((float(obstacleResolution) - 1.0) / (2.0 * bound)), vec3(0), vec3(limit));
+    ivec3 i = ivec3(f);
+    vec3 t = f - vec3(i);
+
+    vec4 c00 = mix(obstacleSample(i.x, i.y, i.z), obstacleSample(i.x + 1, i.y, i.z), t.x);
+    vec4 c10 = mix(obstacleSample(i.x, i.y + 1, i.z), obstacleSample(i.x + 1, i.y + 1, i.z), t.x);
+    vec4 c01 = mix(obstacleSample(i.x, i.y, i.z + 1), obstacleSample(i.x + 1, i.y, i.z + 1), t.x);
+    vec4 c11 = mix(obstacleSample(i.x, i.y + 1, i.z + 1), obstacleSample(i.x + 1, i.y + 1, i.z + 1), t.x);
+    vec4 field = mix(mix(c00, c10, t.y), mix(c01, c11, t.y), t.z);
+
+    if (field.w >= obstacleRange || dot(field.xyz, field.xyz) == 0.0)
+        return vec3(0);
+
+    return steer(field.xyz, vel) * clamp(1.0 - field.w / obstacleRange, 0.0, 1.0);
+}
+
 uint gridIndex(float curPos[3]) {
     return uint((curPos[0] + bound) * cellDimensionReciprocal) 
     + uint((curPos[1] + bound) * cellDimensionReciprocal) * cellsPerAxis 
@@ -122,16 +188,31 @@ void flock(Agent a, uint oID) {
     vec3 offset = oPos - pos;
     float sqrDist = offset.x * offset.x + offset.y * offset.y + offset.z * offset.z;
 
+    // Field of view test without a sqrt, see SimulationCPU WithinView
+    float facing = dot(vel, offset);
+    bvec3 visible = greaterThanEqual(vec3(facing * abs(facing)), viewThresholds * (dot(vel, vel) * sqrDist));
+
     if (sqrDist < radii.x) {
-        align += oVel;
+        if (visible.x)
+            align += oVel;
+        else
+            rejected++;
     }
     if (sqrDist < radii.y) {
-        float strength = 1.0 - (sqrDist / radii.y);
-        separate += -offset * strength;
+        if (visible.y) {
+            float strength = 1.0 - (sqrDist / radii.y);
+            separate += -offset * strength;
+        }
+        else
+            rejected++;
     }
     if (sqrDist < radii.z) {
-        neighbours++;
-        cohese += oPos;
+        if (visible.z) {
+            neighbours++;
+            cohese += oPos;
+        }
+        else
+            rejected++;
     }
 }
 
@@ -160,6 +241,7 @@ void main(void) {
     separate = vel;
     cohese = pos;
     neighbours = 1;
+    rejected = 0;
     vec3 acceleration = vec3(0);
 
     uint gridXY = cellsPerAxis * cellsPerAxis;
@@ -210,6 +292,9 @@ void main(void) {
     traverseCell(agent, x, ynext, znext);
     traverseCell(agent, xnext, ynext, znext);
 
+    if (rejected > 0)
+        atomicAdd(fovRejected, rejected);
+
     cohese /= neighbours;
     cohese -= pos;
 
@@ -217,6 +302,10 @@ void main(void) {
     acceleration += steer(separate, vel) * weights.y;
     acceleration += steer(cohese, vel) * weights.z;
     acceleration += interactWithRay(pos) * weights.w;
+    acceleration += avoidObstacles(pos, vel) * obstacleWeight;
+
+    if (boundaryMode == 1)
+        acceleration += contain(pos);
 
     agents[bID].pos[0] += vel.x * dt;
     agents[bID].pos[1] += vel.y * dt;
@@ -229,7 +318,10 @@ void main(void) {
     agents[bID].vel[1] = vel.y;
     agents[bID].vel[2] = vel.z;
 
-    wrap(agents[bID].pos);
+    if (boundaryMode == 1)
+        clampBounds(agents[bID].pos);
+    else
+        wrap(agents[bID].pos);
 
     agents[bID].cell = gridIndex(agents[bID].pos);
 }
\ No newline at end of file
@@ -3,6 +3,8 @@
 #include "../Common/Vector3.h"
 
 namespace NCL {
+	using namespace NCL::Maths;
+
 	struct Agent {
 		Vector3 position;
 		Vector3 velocity;
@@ -0,0 +1,44 @@
+#include "CandidateBuffer.h"
+
+using namespace NCL;
+
+int CandidateBuffer::cap = 0;
+std::atomic<int> CandidateBuffer::totalAllocations(0);
+std::atomic<int> CandidateBuffer::totalCapped(0);
+
+namespace {
+	std::vector<int>& ThreadCandidates() {
+		thread_local std::vector<int> candidates;
+		return candidates;
+	}
+}
+
+CandidateBuffer::CandidateBuffer() : indices(ThreadCandidates()) {
+	allocations = 0;
+	capped = 0;
+
+	if (cap > 0 && indices.capacity() < (size_t)cap) {
+		indices.reserve(cap);
+		allocations++;
+	}
+	capacity = indices.capacity();
+}
+
+CandidateBuffer::~CandidateBuffer() {
+	// Flushed once per chunk so the shared counters stay off the per agent path
+	if (allocations > 0) {
+		totalAllocations += allocations;
+	}
+	if (capped > 0) {
+		totalCapped += capped;
+	}
+}
+
+void CandidateBuffer::SetCap(int maxCandidates) {
+	cap = maxCandidates > 0 ? maxCandidates : 0;
+}
+
+void CandidateBuffer::ResetStats() {
+	totalAllocations = 0;
+	totalCapped = 0;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <vector>
+
+namespace NCL {
+	// Neighbour queries fill the calling thread's candidate list rather than a fresh vector. Each thread
+	// keeps its list for life and it never shrinks, so once it has grown to the largest neighbourhood
+	// seen a step makes no heap allocations. With a cap set the list is reserved to the cap up front
+	// and queries stop appending there, so it never grows at all.
+	class CandidateBuffer {
+	public:
+		// Binds the calling thread's list. Construct one per chunk of agents, on the thread that runs it.
+		CandidateBuffer();
+		~CandidateBuffer();
+
+		// Empties the list ready for the next query
+		std::vector<int>& Begin() {
+			indices.clear();
+			return indices;
+		}
+
+		// Call once the query has filled the list, so growth and capped queries are counted
+		void End() {
+			if (indices.capacity() != capacity) {
+				capacity = indices.capacity();
+				allocations++;
+			}
+			if ((int)indices.size() >= MaxCount()) {
+				capped++;
+			}
+		}
+
+		int MaxCount() const {
+			return cap > 0 ? cap : INT_MAX;
+		}
+
+		// 0 disables the cap
+		static void SetCap(int maxCandidates);
+
+		// Buffer growths and capped queries since the last ResetStats, over every thread
+		static int Allocations() {
+			return totalAllocations;
+		}
+
+		static int Capped() {
+			return totalCapped;
+		}
+
+		static void ResetStats();
+
+	protected:
+		std::vector<int>& indices;
+		size_t capacity;
+		int allocations;
+		int capped;
+
+		static int cap;
+		static std::atomic<int> totalAllocations;
+		static std::atomic<int> totalCapped;
+	};
+}
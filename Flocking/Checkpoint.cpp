@@ -0,0 +1,110 @@
+#include "Checkpoint.h"
+#include "Agent.h"
+#include <cstdio>
+#include <iostream>
+
+using namespace NCL;
+
+namespace {
+	const uint32_t checkpointMagic = 0x4b434c46;
+	// Bump whenever what the simulations write changes
+	const uint32_t checkpointVersion = 4;
+	// Magic, version and agent size come first, then the size of the whole file
+	const size_t sizeOffset = 3 * sizeof(uint32_t);
+}
+
+CheckpointWriter::CheckpointWriter() {
+	Write(checkpointMagic);
+	Write(checkpointVersion);
+	Write((uint32_t)sizeof(Agent));
+	Write((uint64_t)0);
+}
+
+void CheckpointWriter::WriteString(const std::string& value) {
+	Write((int)value.size());
+	Write(value.data(), value.size());
+}
+
+bool CheckpointWriter::SaveToFile(const std::string& filename) const {
+	FILE* file = fopen(filename.c_str(), "wb");
+	if (!file) {
+		std::cout << "Can't write checkpoint " << filename << std::endl;
+		return false;
+	}
+	// The size is only known now, and goes in without touching the buffer
+	uint64_t size = buffer.size();
+	bool written = fwrite(buffer.data(), 1, sizeOffset, file) == sizeOffset;
+	written = written && fwrite(&size, sizeof(size), 1, file) == 1;
+	size_t rest = buffer.size() - sizeOffset - sizeof(size);
+	written = written && fwrite(buffer.data() + sizeOffset + sizeof(size), 1, rest, file) == rest;
+	written = fclose(file) == 0 && written;
+	if (!written) {
+		std::cout << "Checkpoint " << filename << " was not completely written" << std::endl;
+	}
+	return written;
+}
+
+CheckpointReader::CheckpointReader(const std::string& filename) {
+	offset = 0;
+	valid = false;
+
+	FILE* file = fopen(filename.c_str(), "rb");
+	if (!file) {
+		std::cout << "Can't open checkpoint " << filename << std::endl;
+		return;
+	}
+	// long is 32 bits on Windows, which would stop at 2GB
+#ifdef _WIN32
+	_fseeki64(file, 0, SEEK_END);
+	long long size = _ftelli64(file);
+	_fseeki64(file, 0, SEEK_SET);
+#else
+	fseeko(file, 0, SEEK_END);
+	long long size = (long long)ftello(file);
+	fseeko(file, 0, SEEK_SET);
+#endif
+
+	buffer.resize(size > 0 ? size : 0);
+	bool read = fread(buffer.data(), 1, buffer.size(), file) == buffer.size();
+	fclose(file);
+
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	uint32_t agentSize = 0;
+	uint64_t fileSize = 0;
+	valid = read;
+	Read(magic);
+	Read(version);
+	Read(agentSize);
+	if (!valid || magic != checkpointMagic || version != checkpointVersion || agentSize != sizeof(Agent)) {
+		std::cout << "Checkpoint " << filename << " is from another version or not a checkpoint" << std::endl;
+		valid = false;
+		return;
+	}
+	// Caught here, before anything is restored from it, rather than part way through the simulation's state
+	if (!Read(fileSize) || fileSize != buffer.size()) {
+		std::cout << "Checkpoint " << filename << " is incomplete" << std::endl;
+		valid = false;
+	}
+}
+
+bool CheckpointReader::Read(void* data, size_t bytes) {
+	if (!valid || offset + bytes > buffer.size()) {
+		valid = false;
+		return false;
+	}
+	memcpy(data, &buffer[offset], bytes);
+	offset += bytes;
+	return true;
+}
+
+bool CheckpointReader::ReadString(std::string& value) {
+	int size = 0;
+	if (!Read(size) || size < 0 || offset + size > buffer.size()) {
+		valid = false;
+		return false;
+	}
+	value.assign(&buffer[offset], size);
+	offset += size;
+	return true;
+}
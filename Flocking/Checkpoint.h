@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace NCL {
+	// Simulation state is gathered into one buffer and written with a single sequential write, and read
+	// back the same way, so a checkpoint of any size costs about what the disk takes to stream it. The
+	// file opens with a magic number, a format version and the agent size, and is refused if they differ.
+	// Its own size comes next, so a file cut short is refused before anything is restored from it.
+	class CheckpointWriter {
+	public:
+		CheckpointWriter();
+
+		void Write(const void* data, size_t bytes) {
+			size_t offset = buffer.size();
+			buffer.resize(offset + bytes);
+			memcpy(&buffer[offset], data, bytes);
+		}
+
+		template <typename T>
+		void Write(const T& value) {
+			Write(&value, sizeof(T));
+		}
+
+		template <typename T>
+		void WriteArray(const T* values, int count) {
+			Write(count);
+			Write(values, count * sizeof(T));
+		}
+
+		void WriteString(const std::string& value);
+
+		bool SaveToFile(const std::string& filename) const;
+
+	protected:
+		std::vector<char> buffer;
+	};
+
+	class CheckpointReader {
+	public:
+		// Reads the whole file and checks its header. Valid is false if it couldn't.
+		CheckpointReader(const std::string& filename);
+
+		bool Valid() const {
+			return valid;
+		}
+
+		// Every read fails once one has run past the end, so a truncated file only needs checking at the end
+		bool Read(void* data, size_t bytes);
+
+		template <typename T>
+		bool Read(T& value) {
+			return Read(&value, sizeof(T));
+		}
+
+		// Fails if the stored array doesn't hold exactly count values
+		template <typename T>
+		bool ReadArray(T* values, int count) {
+			int stored = 0;
+			if (!Read(stored) || stored != count) {
+				valid = false;
+				return false;
+			}
+			return Read(values, count * sizeof(T));
+		}
+
+		bool ReadString(std::string& value);
+
+	protected:
+		std::vector<char> buffer;
+		size_t offset;
+		bool valid;
+	};
+}
@@ -49,6 +49,8 @@ namespace NCL {
 		~Debug() {}
 
 		static std::vector<DebugStringEntry>	stringEntries;
+		// Lines can outlive the frame, so they can't go in a FrameArena. Trimming never gives back capacity,
+		// so this only allocates when more lines are drawn than ever before.
 		static std::vector<DebugLineEntry>	lineEntries;
 
 		static FlockingRenderer* renderer;
@@ -0,0 +1,311 @@
+#include "DomainDecomposition.h"
+#include "Agent.h"
+#include "Flock.h"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+using namespace NCL;
+
+namespace {
+	// Each agent travels as its id followed by its state. Ranks on one host share a layout; a cluster
+	// transport would have to agree on one.
+	const size_t recordSize = sizeof(int32_t) + sizeof(Agent);
+
+	// Every message opens with the sender's cost and where it wants the border between the two ranks
+	const size_t headerSize = sizeof(double) + sizeof(float);
+	const float noProposal = FLT_MAX;
+
+	void AppendCount(std::vector<char>& message, int32_t count) {
+		size_t offset = message.size();
+		message.resize(offset + sizeof(int32_t));
+		memcpy(&message[offset], &count, sizeof(int32_t));
+	}
+
+	void PatchCount(std::vector<char>& message, size_t offset, int32_t count) {
+		memcpy(&message[offset], &count, sizeof(int32_t));
+	}
+
+	int32_t ReadCount(const std::vector<char>& message, size_t offset) {
+		int32_t count;
+		memcpy(&count, &message[offset], sizeof(int32_t));
+		return count;
+	}
+
+	void AppendAgent(std::vector<char>& message, int32_t id, const Agent& agent) {
+		size_t offset = message.size();
+		message.resize(offset + recordSize);
+		memcpy(&message[offset], &id, sizeof(int32_t));
+		memcpy(&message[offset + sizeof(int32_t)], &agent, sizeof(Agent));
+	}
+
+	void ReadAgent(const std::vector<char>& message, size_t offset, int32_t& id, Agent& agent) {
+		memcpy(&id, &message[offset], sizeof(int32_t));
+		memcpy(&agent, &message[offset + sizeof(int32_t)], sizeof(Agent));
+	}
+}
+
+DomainDecomposition::DomainDecomposition(DomainTransport* transport, float maxBound, float haloWidth, float balanceThreshold, int balanceInterval)
+	: balancer(balanceThreshold, balanceInterval) {
+	this->transport = transport;
+	this->maxBound = maxBound;
+	this->haloWidth = haloWidth;
+
+	int rank = Rank();
+	int ranks = NumRanks();
+	for (int r = 0; r <= ranks; ++r) {
+		splits.push_back(-maxBound + 2 * maxBound * r / ranks);
+	}
+
+	int left = (rank + ranks - 1) % ranks;
+	int right = (rank + 1) % ranks;
+	if (left != rank) {
+		peers.push_back(left);
+	}
+	if (right != rank && right != left) {
+		peers.push_back(right);
+	}
+	outgoing.resize(peers.size());
+
+	ownedCount = 0;
+	ghostCount = 0;
+	lastMigrated = 0;
+	lastExchangeTime = 0;
+
+	peerCosts[0] = 0;
+	peerCosts[1] = 0;
+	imbalance = 1.0f;
+}
+
+DomainDecomposition::~DomainDecomposition() {
+	delete transport;
+}
+
+int DomainDecomposition::RankOf(float x) const {
+	int rank = 0;
+	while (rank < NumRanks() - 1 && x >= splits[rank + 1]) {
+		rank++;
+	}
+	return rank;
+}
+
+// The shorter way round the ring, so an agent wrapping off one end goes straight to the other
+int DomainDecomposition::PeerToward(int targetRank) const {
+	int ranks = NumRanks();
+	int distance = (targetRank - Rank() + ranks) % ranks;
+	return distance <= ranks / 2 ? (Rank() + 1) % ranks : (Rank() + ranks - 1) % ranks;
+}
+
+int DomainDecomposition::PeerIndex(int peer) const {
+	return peers[0] == peer ? 0 : 1;
+}
+
+// Index into splits of the border this rank shares with peer, or -1 when they only meet across the wrap
+int DomainDecomposition::BorderWith(int peer) const {
+	if (peer == Rank() + 1) {
+		return peer;
+	}
+	if (peer == Rank() - 1) {
+		return Rank();
+	}
+	return -1;
+}
+
+// Where to move the border so that agents costing about amount end up on the other side of it. Only owned
+// agents are handed over, and never all of them.
+float DomainDecomposition::ShedCost(const Flock* flock, const std::vector<float>& agentCosts, int border, double amount) {
+	bool upper = border == Rank() + 1;
+
+	shedding.clear();
+	for (int i = 0; i < ownedCount; ++i) {
+		shedding.push_back(std::make_pair(flock->agents[i].position.x, agentCosts[i]));
+	}
+	if (upper) {
+		std::sort(shedding.begin(), shedding.end(), [](const std::pair<float, float>& a, const std::pair<float, float>& b) {
+			return a.first > b.first;
+		});
+	}
+	else {
+		std::sort(shedding.begin(), shedding.end());
+	}
+
+	double shed = 0;
+	int count = 0;
+	while (count < (int)shedding.size() - 1 && shed < amount) {
+		shed += shedding[count++].second;
+	}
+	if (count == 0) {
+		return noProposal;
+	}
+	return (shedding[count - 1].first + shedding[count].first) * 0.5f;
+}
+
+void DomainDecomposition::Swap(Flock* flock, int slotA, int slotB) {
+	if (slotA == slotB) {
+		return;
+	}
+	Agent agent = flock->agents[slotA];
+	flock->agents[slotA] = flock->agents[slotB];
+	flock->agents[slotB] = agent;
+
+	int id = flock->agentIds[slotA];
+	flock->agentIds[slotA] = flock->agentIds[slotB];
+	flock->agentIds[slotB] = id;
+	flock->agentSlots[flock->agentIds[slotA]] = slotA;
+	flock->agentSlots[flock->agentIds[slotB]] = slotB;
+
+	if (onSwap) {
+		onSwap(slotA, slotB);
+	}
+}
+
+// The x coordinate is squeezed into the slab, so the ranks between them start with an evenly spread flock
+void DomainDecomposition::Distribute(Flock* flock) {
+	int count = flock->Size();
+	int rank = Rank();
+	int ranks = NumRanks();
+	float width = splits[rank + 1] - splits[rank];
+
+	ownedCount = 0;
+	ghostCount = 0;
+	for (int slot = 0; slot < count; ++slot) {
+		if ((long long)flock->AgentId(slot) * ranks / count != rank) {
+			continue;
+		}
+		Agent& agent = flock->agents[slot];
+		agent.position.x = splits[rank] + (agent.position.x + maxBound) / (2 * maxBound) * width;
+		Swap(flock, slot, ownedCount++);
+	}
+}
+
+void DomainDecomposition::Exchange(Flock* flock, const std::vector<float>& agentCosts) {
+	auto start = std::chrono::high_resolution_clock::now();
+	int rank = Rank();
+	int ranks = NumRanks();
+	int peerCount = (int)peers.size();
+
+	// Migrants first, so the receiver can add them to its owned agents before placing the ghosts behind them
+	int migrants[2] = { 0, 0 };
+	for (int p = 0; p < peerCount; ++p) {
+		outgoing[p].resize(headerSize);
+		AppendCount(outgoing[p], 0);
+	}
+	leaving.clear();
+	for (int i = 0; i < ownedCount; ++i) {
+		const Agent& agent = flock->agents[i];
+		int owner = RankOf(agent.position.x);
+		if (owner != rank) {
+			int p = PeerIndex(PeerToward(owner));
+			AppendAgent(outgoing[p], flock->AgentId(i), agent);
+			migrants[p]++;
+			leaving.push_back(i);
+		}
+	}
+	// Highest first, so the last owned slot is never one that is still to leave
+	for (int k = (int)leaving.size() - 1; k >= 0; --k) {
+		Swap(flock, leaving[k], --ownedCount);
+	}
+	lastMigrated = (int)leaving.size();
+
+	// Measured over the agents that stay, as the ones leaving would drag a border out of the slab
+	double cost = 0;
+	for (int i = 0; i < ownedCount; ++i) {
+		cost += agentCosts[i];
+	}
+	std::vector<double> neighbourhood(1, cost);
+	for (int p = 0; p < peerCount; ++p) {
+		neighbourhood.push_back(peerCosts[p]);
+	}
+	// The neighbours' costs are a step old, which the interval between moves easily covers
+	imbalance = LoadBalancer::Imbalance(neighbourhood);
+	bool balance = balancer.Due(imbalance);
+
+	float proposals[2] = { noProposal, noProposal };
+	for (int p = 0; p < peerCount; ++p) {
+		int border = BorderWith(peers[p]);
+		if (balance && border >= 0 && cost > peerCosts[p]) {
+			proposals[p] = ShedCost(flock, agentCosts, border, (cost - peerCosts[p]) * 0.5);
+		}
+	}
+
+	for (int p = 0; p < peerCount; ++p) {
+		memcpy(&outgoing[p][0], &cost, sizeof(double));
+		memcpy(&outgoing[p][sizeof(double)], &proposals[p], sizeof(float));
+	}
+
+	int halos[2] = { 0, 0 };
+	size_t haloOffsets[2] = { 0, 0 };
+	for (int p = 0; p < peerCount; ++p) {
+		PatchCount(outgoing[p], headerSize, migrants[p]);
+		haloOffsets[p] = outgoing[p].size();
+		AppendCount(outgoing[p], 0);
+	}
+	for (int i = 0; i < ownedCount; ++i) {
+		const Agent& agent = flock->agents[i];
+		if (rank > 0 && agent.position.x < splits[rank] + haloWidth) {
+			int p = PeerIndex(rank - 1);
+			AppendAgent(outgoing[p], flock->AgentId(i), agent);
+			halos[p]++;
+		}
+		if (rank < ranks - 1 && agent.position.x >= splits[rank + 1] - haloWidth) {
+			int p = PeerIndex(rank + 1);
+			AppendAgent(outgoing[p], flock->AgentId(i), agent);
+			halos[p]++;
+		}
+	}
+	for (int p = 0; p < peerCount; ++p) {
+		PatchCount(outgoing[p], haloOffsets[p], halos[p]);
+	}
+
+	transport->Exchange(peers, outgoing, incoming);
+
+	// Both ranks see both proposals, so they agree on the border. The lower rank's wins if both moved it.
+	bool moved = false;
+	for (int p = 0; p < peerCount; ++p) {
+		float theirs;
+		memcpy(&peerCosts[p], &incoming[p][0], sizeof(double));
+		memcpy(&theirs, &incoming[p][sizeof(double)], sizeof(float));
+
+		int border = BorderWith(peers[p]);
+		float proposal = rank < peers[p] ? (proposals[p] != noProposal ? proposals[p] : theirs) : (theirs != noProposal ? theirs : proposals[p]);
+		if (border >= 0 && proposal != noProposal) {
+			splits[border] = proposal;
+			moved = true;
+		}
+	}
+	if (moved) {
+		balancer.Rebalanced();
+	}
+
+	// Last step's ghosts fall out of the active range and are replaced wholesale
+	ghostCount = 0;
+	for (int p = 0; p < peerCount; ++p) {
+		int count = ReadCount(incoming[p], headerSize);
+		for (int k = 0; k < count; ++k) {
+			int32_t id;
+			Agent agent;
+			ReadAgent(incoming[p], headerSize + sizeof(int32_t) + k * recordSize, id, agent);
+
+			int slot = flock->AgentSlot(id);
+			flock->agents[slot] = agent;
+			Swap(flock, slot, ownedCount++);
+		}
+	}
+	for (int p = 0; p < peerCount; ++p) {
+		size_t offset = headerSize + sizeof(int32_t) + ReadCount(incoming[p], headerSize) * recordSize;
+		int count = ReadCount(incoming[p], offset);
+		for (int k = 0; k < count; ++k) {
+			int32_t id;
+			Agent agent;
+			ReadAgent(incoming[p], offset + sizeof(int32_t) + k * recordSize, id, agent);
+
+			int slot = flock->AgentSlot(id);
+			flock->agents[slot] = agent;
+			Swap(flock, slot, ownedCount + ghostCount++);
+		}
+	}
+
+	lastExchangeTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "DomainTransport.h"
+#include "LoadBalancer.h"
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace NCL {
+	class Flock;
+
+	// Splits the world cube into one slab along x per rank, each stepped by its own process. A rank keeps the
+	// agents it owns at the front of its flock, followed by ghosts: copies of the agents its neighbours own
+	// within haloWidth of a shared border, refreshed every step. Every other slot holds a stale copy that is
+	// neither stepped nor searched. Ranks form a ring so agents wrapping round the world migrate too, but
+	// halos only cross interior borders, as neighbour searches don't look across the wrap.
+	//
+	// Ranks also send each other the cost of their last step. Once the neighbourhood is uneven enough, a rank
+	// busier than the neighbour across a border moves the border into its own slab until half the difference
+	// lies beyond it, and both ranks apply the move after the same exchange.
+	class DomainDecomposition {
+	public:
+		// Takes ownership of the transport
+		DomainDecomposition(DomainTransport* transport, float maxBound, float haloWidth, float balanceThreshold, int balanceInterval);
+		~DomainDecomposition();
+
+		int Rank() const {
+			return transport->Rank();
+		}
+
+		int NumRanks() const {
+			return transport->NumRanks();
+		}
+
+		int RankOf(float x) const;
+
+		// Every rank starts with an equal share of the ids, moved into its slab and to the front of its flock.
+		// Called once, before the first Exchange.
+		void Distribute(Flock* flock);
+
+		// Sends owned agents that have left the slab to the rank they moved towards, and the owned agents near
+		// each border to the rank across it, then takes in what the neighbours sent. Every rank has to call
+		// this once per step, so a rank that stops stepping stalls its neighbours. agentCosts holds what each
+		// slot cost to step last time.
+		void Exchange(Flock* flock, const std::vector<float>& agentCosts);
+
+		// Called with every pair of slots Exchange swaps, so per slot data can follow its agent
+		void SetSwapCallback(const std::function<void(int slotA, int slotB)>& callback) {
+			onSwap = callback;
+		}
+
+		int OwnedCount() const {
+			return ownedCount;
+		}
+
+		int GhostCount() const {
+			return ghostCount;
+		}
+
+		// Owned agents and ghosts, which are the only slots worth searching
+		int ActiveCount() const {
+			return ownedCount + ghostCount;
+		}
+
+		int LastMigrated() const {
+			return lastMigrated;
+		}
+
+		float LastExchangeTime() const {
+			return lastExchangeTime;
+		}
+
+		// This rank's and its neighbours' busiest cost over their mean. Ranks further away aren't known here.
+		float Imbalance() const {
+			return imbalance;
+		}
+
+	protected:
+		int PeerToward(int targetRank) const;
+		int PeerIndex(int peer) const;
+		int BorderWith(int peer) const;
+		float ShedCost(const Flock* flock, const std::vector<float>& agentCosts, int border, double amount);
+		void Swap(Flock* flock, int slotA, int slotB);
+
+		DomainTransport* transport;
+		float maxBound;
+		float haloWidth;
+
+		// splits[r] and splits[r + 1] bound rank r's slab
+		std::vector<float> splits;
+		// The distinct ranks either side of this one
+		std::vector<int> peers;
+
+		int ownedCount;
+		int ghostCount;
+		int lastMigrated;
+		float lastExchangeTime;
+
+		LoadBalancer balancer;
+		double peerCosts[2];
+		float imbalance;
+
+		// Kept between steps so packing doesn't allocate once the halos have reached their largest
+		std::vector<std::vector<char>> outgoing;
+		std::vector<std::vector<char>> incoming;
+		std::vector<int> leaving;
+		std::vector<std::pair<float, float>> shedding;
+
+		std::function<void(int slotA, int slotB)> onSwap;
+	};
+}
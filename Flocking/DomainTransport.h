@@ -0,0 +1,20 @@
+#pragma once
+
+#include <vector>
+
+namespace NCL {
+	// How domain ranks talk to each other. Everything the decomposition sends goes through Exchange, which
+	// has the same shape as a neighbourhood all-to-all on a cluster, so a transport for a real interconnect
+	// only has to implement this.
+	class DomainTransport {
+	public:
+		virtual ~DomainTransport() {}
+
+		virtual int Rank() const = 0;
+		virtual int NumRanks() const = 0;
+
+		// Sends outgoing[i] to peers[i] and fills incoming[i] with the message peers[i] sent this rank,
+		// blocking until every message has gone and arrived. Every peer has to make the matching call.
+		virtual void Exchange(const std::vector<int>& peers, const std::vector<std::vector<char>>& outgoing, std::vector<std::vector<char>>& incoming) = 0;
+	};
+}
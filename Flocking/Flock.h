@@ -2,6 +2,7 @@
 
 #include "Agent.h"
 #include "Simulation.h"
+#include "../Common/Maths.h"
 #include <vector>
 
 namespace NCL {
@@ -13,6 +14,7 @@ namespace NCL {
 			separationWeight = settings.separationWeight;
 			cohesionWeight = settings.cohesionWeight;
 			avoidanceWeight = settings.avoidanceWeight;
+			obstacleWeight = settings.obstacleWeight;
 
 			alignmentRadius = settings.alignmentRadius;
 			separationRadius = settings.separationRadius;
@@ -24,6 +26,12 @@ namespace NCL {
 			cohesionRadiusSquared = cohesionRadius * cohesionRadius;
 			avoidanceRadiusSquared = avoidanceRadius * avoidanceRadius;
 
+			obstacleRange = settings.obstacleRange;
+
+			alignmentViewThreshold = ViewThreshold(settings.alignmentFOV);
+			separationViewThreshold = ViewThreshold(settings.separationFOV);
+			cohesionViewThreshold = ViewThreshold(settings.cohesionFOV);
+
 			maxRadius = std::fmax(alignmentRadius, std::fmax(separationRadius, cohesionRadius));
 			maxRadiusSquared = fmax(alignmentRadiusSquared, std::fmax(separationRadiusSquared, cohesionRadiusSquared));
 
@@ -31,20 +39,40 @@ namespace NCL {
 			maxSteeringAngle = settings.maxSteeringAngle;
 
 			maxBound = settings.maxBound;
+			boundaryMode = settings.boundaryMode;
+			containMargin = settings.containMargin;
 			size = settings.numAgents;
 
 			this->agents = agents;
+			ownsAgents = true;
 
 			for (int i = 0; i < size; ++i) {
 				agentVector.emplace_back(&agents[i]);
+				agentIds.push_back(i);
+				agentSlots.push_back(i);
 			}
 		}
 
 		~Flock() {
-			delete[] agents;
+			if (ownsAgents) {
+				delete[] agents;
+			}
 			agents = nullptr;
 		}
 
+		// Moves the flock onto storage that someone else allocated (and will free), already holding the agents
+		void UseExternalStorage(Agent* storage) {
+			if (ownsAgents) {
+				delete[] agents;
+			}
+			agents = storage;
+			ownsAgents = false;
+
+			for (int i = 0; i < size; ++i) {
+				agentVector[i] = &agents[i];
+			}
+		}
+
 		int Size() const {
 			return size;
 		}
@@ -57,17 +85,62 @@ namespace NCL {
 			return &agents[index];
 		}
 
+		// Agents keep the id of the slot they were created in, wherever reordering moves them
+		int AgentId(int slot) const {
+			return agentIds[slot];
+		}
+
+		int AgentSlot(int id) const {
+			return agentSlots[id];
+		}
+
+		// Moves the agent in slot order[i] into slot i
+		void Permute(const std::vector<int>& order, ThreadPool* pool) {
+			movedAgents.resize(size);
+			movedIds.resize(size);
+
+			pool->ParallelFor(size, 16384, [&](int begin, int end) {
+				for (int i = begin; i < end; ++i) {
+					movedAgents[i] = agents[order[i]];
+					movedIds[i] = agentIds[order[i]];
+				}
+			});
+			pool->ParallelFor(size, 16384, [&](int begin, int end) {
+				for (int i = begin; i < end; ++i) {
+					agents[i] = movedAgents[i];
+					agentIds[i] = movedIds[i];
+					agentSlots[movedIds[i]] = i;
+				}
+			});
+		}
+
+		bool HasLimitedView() const {
+			return alignmentViewThreshold > -1.0f || separationViewThreshold > -1.0f || cohesionViewThreshold > -1.0f;
+		}
+
 	protected:
+		// Stores cos(fov / 2) as c|c| so it can be compared against a signed squared cosine without a sqrt
+		static float ViewThreshold(float fieldOfView) {
+			float c = cos(Maths::DegreesToRadians(fmin(fieldOfView, 360.0f) * 0.5f));
+			return c * fabs(c);
+		}
 
 		int size;
 		Agent* agents;
+		bool ownsAgents;
 
 		std::vector<Agent*> agentVector;
+		std::vector<int> agentIds;
+		std::vector<int> agentSlots;
+		// Permute's scratch, kept so reordering doesn't allocate
+		std::vector<Agent> movedAgents;
+		std::vector<int> movedIds;
 
 		float alignmentWeight;
 		float separationWeight;
 		float cohesionWeight;
 		float avoidanceWeight;
+		float obstacleWeight;
 
 		float alignmentRadius;
 		float separationRadius;
@@ -79,6 +152,12 @@ namespace NCL {
 		float cohesionRadiusSquared;
 		float avoidanceRadiusSquared;
 
+		float obstacleRange;
+
+		float alignmentViewThreshold;
+		float separationViewThreshold;
+		float cohesionViewThreshold;
+
 		float maxRadius;
 		float maxRadiusSquared;
 
@@ -86,10 +165,14 @@ namespace NCL {
 		float maxSteeringAngle;
 
 		float maxBound;
+		Simulation::BoundaryMode boundaryMode;
+		float containMargin;
 
 		friend class Simulation;
 		friend class SimulationCPU;
 		friend class SimulationGPU;
 		friend class FlockingRenderer;
+		friend class DomainDecomposition;
+		friend class NumaPartitioner;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,96 @@
+#include "FlockViewer.h"
+#include "Agent.h"
+#include "../Common/Window.h"
+
+using namespace NCL;
+
+namespace {
+	// A simulation whose heartbeat hasn't moved for this long has stopped or restarted
+	const float detachTime = 2.0f;
+}
+
+FlockViewer::FlockViewer(const std::string& stateName, FlockingRenderer* renderer) {
+	this->stateName = stateName;
+	this->renderer = renderer;
+	state = nullptr;
+	bufFlock = 0;
+	step = 0;
+	heartbeat = 0;
+	sinceLastBeat = 0;
+	drawBox = true;
+}
+
+FlockViewer::~FlockViewer() {
+	Detach();
+}
+
+void FlockViewer::Attach() {
+	state = SharedFlockState::Open(stateName);
+	if (!state) {
+		return;
+	}
+
+	// Nothing blends between steps here, so the previous agents binding gets the same buffer
+	glGenBuffers(1, &bufFlock);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, bufFlock);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, state->NumAgents() * sizeof(Agent), nullptr, GL_DYNAMIC_COPY);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, bufFlock);
+
+	renderer->InitFlock(bufFlock, 0, state->MaxBound(), state->ModelScale());
+	renderer->SetInterpolation(1.0f);
+
+	step = 0;
+	heartbeat = state->Heartbeat();
+	sinceLastBeat = 0;
+}
+
+void FlockViewer::Detach() {
+	if (!state) {
+		return;
+	}
+	delete state;
+	state = nullptr;
+
+	glDeleteBuffers(1, &bufFlock);
+	bufFlock = 0;
+	renderer->SetAgentCount(0);
+}
+
+// Uploads straight from the shared segment. If the simulation overwrites the state mid upload, the
+// upload is simply repeated, so the simulation is never held up by the viewer.
+void FlockViewer::Update(float dt) {
+	renderer->UpdateCamera(dt);
+
+	if (!state) {
+		Attach();
+	}
+	if (state) {
+		state->Read(step, [this](const Agent* agents, int count) {
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufFlock);
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(Agent), agents);
+			renderer->SetAgentCount(count);
+		});
+
+		uint64_t latestBeat = state->Heartbeat();
+		sinceLastBeat = latestBeat != heartbeat ? 0 : sinceLastBeat + dt;
+		heartbeat = latestBeat;
+		if (sinceLastBeat > detachTime) {
+			Detach();
+		}
+	}
+
+	if (Window::GetKeyboard()->KeyPressed(KeyboardKeys::B)) {
+		drawBox = !drawBox;
+	}
+
+	if (state) {
+		renderer->DrawString("Viewing " + stateName + ", step " + std::to_string(step),
+			Vector2(1, 2), Vector4(0.5f, 0.3f, 0.8f, 1), 10.0f);
+	}
+	else {
+		renderer->DrawString("Waiting for simulation " + stateName,
+			Vector2(1, 2), Vector4(0.5f, 0.3f, 0.8f, 1), 10.0f);
+	}
+	renderer->DrawBoundingBox(drawBox && state ? state->MaxBound() : 0);
+	renderer->Render();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "FlockingRenderer.h"
+#include "SharedFlockState.h"
+
+namespace NCL {
+	// Draws a flock that another process is simulating, read from its shared state. Waits for the
+	// simulation to appear, and goes back to waiting once its heartbeat stops, which is also what
+	// happens when it restarts with a different flock. A paused simulation keeps beating.
+	class FlockViewer {
+	public:
+		FlockViewer(const std::string& stateName, FlockingRenderer* renderer);
+		~FlockViewer();
+
+		void Update(float dt);
+
+	protected:
+		void Attach();
+		void Detach();
+
+		std::string stateName;
+		FlockingRenderer* renderer;
+		SharedFlockState* state;
+
+		GLuint bufFlock;
+		uint64_t step;
+		uint64_t heartbeat;
+		float sinceLastBeat;
+		bool drawBox;
+	};
+}
@@ -12,6 +12,7 @@ FlockingRenderer::FlockingRenderer() : OGLRenderer(*Window::GetWindow()) {
 	glEnable(GL_DEPTH_TEST);
 
 	numAgents = 0;
+	interpolation = 1.0f;
 	
 	darkMode = false;
 	backgroundCol = Vector4(1, 1, 1, 1);
@@ -133,6 +134,7 @@ void FlockingRenderer::RenderFlock() {
 	int scaleLocation = 0;
 	int boundLocation = 0;
 	int gridVisualiseLocation = 0;
+	int interpolationLocation = 0;
 
 	// Fragment uniforms
 	int camPosLocation = 0;
@@ -150,6 +152,7 @@ void FlockingRenderer::RenderFlock() {
 	scaleLocation = glGetUniformLocation(shaderID, "scaleMat");
 	boundLocation = glGetUniformLocation(shaderID, "bound");
 	gridVisualiseLocation = glGetUniformLocation(shaderID, "visualiseGrid");
+	interpolationLocation = glGetUniformLocation(shaderID, "interpolation");
 
 	camPosLocation = glGetUniformLocation(shaderID, "cameraPos");
 	lightPosLocation = glGetUniformLocation(shaderID, "lightPos");;
@@ -163,6 +166,7 @@ void FlockingRenderer::RenderFlock() {
 	glUniform1f(boundLocation, maxBound);
 	glUniform1i(useLightingLocation, useLighting);
 	glUniform1i(gridVisualiseLocation, visualiseGridColours);
+	glUniform1f(interpolationLocation, interpolation);
 
 	glUniform3fv(camPosLocation, 1, (float*)&camPos);
 
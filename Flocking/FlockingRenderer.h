@@ -28,6 +28,12 @@ namespace NCL {
 
 		void ToggleGridVisualisation();
 
+		// Draws only the first count agents of the buffer
+		void SetAgentCount(int count) { numAgents = count; }
+
+		// 0 draws agents where they were before the latest step, 1 where they are now
+		void SetInterpolation(float alpha) { interpolation = alpha; }
+
 		void UpdateCamera(float dt) { cam->UpdateCamera(dt); }
 
 		void DrawBoundingBox(float bound);
@@ -53,6 +59,7 @@ namespace NCL {
 		int numAgents;
 		float maxBound;
 		float modelScale;
+		float interpolation;
 
 		Camera* cam;
 
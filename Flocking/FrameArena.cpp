@@ -0,0 +1,175 @@
+#include "FrameArena.h"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using namespace NCL;
+
+#ifdef _DEBUG
+bool FrameArena::poisonOnReset = true;
+#else
+bool FrameArena::poisonOnReset = false;
+#endif
+
+namespace {
+	const unsigned char poisonByte = 0xDD;
+
+	std::mutex slotMutex;
+	std::vector<int> freeSlots;
+	int nextThreadSlot = 0;
+
+	// Holds a thread's slot while the thread runs and gives it back when the thread exits, so pools that
+	// come and go keep reusing the same slots rather than running out
+	struct ThreadSlotLease {
+		int slot;
+		int overflowSlot;
+
+		ThreadSlotLease(int overflowSlot) {
+			this->overflowSlot = overflowSlot;
+			std::lock_guard<std::mutex> lock(slotMutex);
+			if (!freeSlots.empty()) {
+				slot = freeSlots.back();
+				freeSlots.pop_back();
+			}
+			else {
+				slot = nextThreadSlot < overflowSlot ? nextThreadSlot++ : overflowSlot;
+			}
+		}
+
+		~ThreadSlotLease() {
+			std::lock_guard<std::mutex> lock(slotMutex);
+			if (slot != overflowSlot) {
+				freeSlots.push_back(slot);
+			}
+		}
+	};
+}
+
+FrameArena::FrameArena(size_t blockSize) {
+	this->blockSize = blockSize;
+	blockAllocations = 0;
+	lastFrameBytes = 0;
+	highWaterMark = 0;
+	lastBlockAllocations = 0;
+
+	regions = new Region[maxThreads + 1];
+	for (int i = 0; i <= maxThreads; ++i) {
+		regions[i].first = nullptr;
+		regions[i].current = nullptr;
+	}
+}
+
+FrameArena::~FrameArena() {
+	for (int i = 0; i <= maxThreads; ++i) {
+		Block* block = regions[i].first;
+		while (block) {
+			Block* next = block->next;
+			delete[] block->memory;
+			delete block;
+			block = next;
+		}
+	}
+	delete[] regions;
+}
+
+// Slots are shared by every arena, and a region left by a thread that exited carries on with the next one
+int FrameArena::ThreadSlot() {
+	thread_local ThreadSlotLease lease(maxThreads);
+	return lease.slot;
+}
+
+void* FrameArena::Allocate(size_t bytes, size_t alignment) {
+	int slot = ThreadSlot();
+	if (slot == maxThreads) {
+		std::lock_guard<std::mutex> lock(overflowMutex);
+		return AllocateFrom(regions[slot], bytes, alignment);
+	}
+	return AllocateFrom(regions[slot], bytes, alignment);
+}
+
+void* FrameArena::AllocateFrom(Region& region, size_t bytes, size_t alignment) {
+	Block* block = region.current;
+	if (block) {
+		uintptr_t address = (uintptr_t)(block->memory + block->used);
+		size_t padding = (alignment - address % alignment) % alignment;
+		if (block->used + padding + bytes <= block->size) {
+			block->used += padding + bytes;
+			return (void*)(address + padding);
+		}
+	}
+
+	// Only the newest block is bumped, so whatever is left in the old one is wasted until Reset
+	Block* fresh = NewBlock(bytes + alignment > blockSize ? bytes + alignment : blockSize);
+	if (block) {
+		block->next = fresh;
+	}
+	else {
+		region.first = fresh;
+	}
+	region.current = fresh;
+	blockAllocations++;
+
+	uintptr_t address = (uintptr_t)fresh->memory;
+	size_t padding = (alignment - address % alignment) % alignment;
+	fresh->used = padding + bytes;
+	return (void*)(address + padding);
+}
+
+FrameArena::Block* FrameArena::NewBlock(size_t size) {
+	Block* block = new Block();
+	block->memory = new char[size];
+	block->size = size;
+	block->used = 0;
+	block->next = nullptr;
+	return block;
+}
+
+void FrameArena::Reset() {
+	size_t used = BytesUsed();
+	lastFrameBytes = used;
+	if (used > highWaterMark) {
+		highWaterMark = used;
+	}
+	lastBlockAllocations = blockAllocations.load();
+
+	for (int i = 0; i <= maxThreads; ++i) {
+		Region& region = regions[i];
+		if (!region.first) {
+			continue;
+		}
+		size_t totalSize = 0;
+		for (Block* block = region.first; block; block = block->next) {
+			if (poisonOnReset) {
+				memset(block->memory, poisonByte, block->used);
+			}
+			totalSize += block->size;
+			block->used = 0;
+		}
+
+		if (region.first->next) {
+			Block* block = region.first;
+			while (block) {
+				Block* next = block->next;
+				delete[] block->memory;
+				delete block;
+				block = next;
+			}
+			region.first = NewBlock(totalSize);
+			if (poisonOnReset) {
+				memset(region.first->memory, poisonByte, totalSize);
+			}
+		}
+		region.current = region.first;
+	}
+	blockAllocations = 0;
+}
+
+size_t FrameArena::BytesUsed() const {
+	size_t used = 0;
+	for (int i = 0; i <= maxThreads; ++i) {
+		for (Block* block = regions[i].first; block; block = block->next) {
+			used += block->used;
+		}
+	}
+	return used;
+}
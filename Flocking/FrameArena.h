@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+
+namespace NCL {
+	// Bump allocator for data that only lives for one step, such as octree nodes. Every thread allocates
+	// from its own region without locking, and Reset drops everything at once. A region that needed more
+	// than one block is rebuilt as a single block of the combined size, so once the arena has seen its
+	// largest frame, steps stop reaching the heap. Nothing allocated here has its destructor run.
+	class FrameArena {
+	public:
+		FrameArena(size_t blockSize = 1 << 20);
+		~FrameArena();
+
+		// Memory for the calling thread. Must not race with Reset.
+		void* Allocate(size_t bytes, size_t alignment = 16);
+
+		template <typename T>
+		T* New(int count) {
+			T* objects = (T*)Allocate(sizeof(T) * count, alignof(T));
+			for (int i = 0; i < count; ++i) {
+				new (&objects[i]) T();
+			}
+			return objects;
+		}
+
+		// Releases every allocation made since the last Reset. Call once nothing allocated here is in use.
+		void Reset();
+
+		// Bytes allocated over every thread between the last two Resets
+		size_t LastFrameBytes() const {
+			return lastFrameBytes;
+		}
+
+		// Largest LastFrameBytes seen so far
+		size_t HighWaterMark() const {
+			return highWaterMark;
+		}
+
+		// Blocks taken from the heap between the last two Resets, which stays at 0 once the arena has warmed up
+		int LastBlockAllocations() const {
+			return lastBlockAllocations;
+		}
+
+		// Fills released memory with a pattern so use after Reset shows up. On by default in debug builds.
+		static void SetPoison(bool poison) {
+			poisonOnReset = poison;
+		}
+
+	protected:
+		struct Block {
+			char* memory;
+			size_t size;
+			size_t used;
+			Block* next;
+		};
+
+		// Padded so threads bumping their own regions don't share cache lines
+		struct Region {
+			Block* first;
+			Block* current;
+			char padding[64 - 2 * sizeof(Block*)];
+		};
+
+		// Threads running at once past this share one region behind a lock
+		static const int maxThreads = 256;
+
+		static int ThreadSlot();
+
+		void* AllocateFrom(Region& region, size_t bytes, size_t alignment);
+		Block* NewBlock(size_t size);
+		size_t BytesUsed() const;
+
+		Region* regions;
+		std::mutex overflowMutex;
+
+		size_t blockSize;
+		std::atomic<int> blockAllocations;
+
+		// Read by the UI while another thread may be stepping
+		std::atomic<size_t> lastFrameBytes;
+		std::atomic<size_t> highWaterMark;
+		std::atomic<int> lastBlockAllocations;
+
+		static bool poisonOnReset;
+	};
+}
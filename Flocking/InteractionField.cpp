@@ -0,0 +1,131 @@
+#include "InteractionField.h"
+#include "../Common/Maths.h"
+
+using namespace NCL;
+
+InteractionField::InteractionField() {
+	bucketThreshold = 32;
+	cellsPerAxis = 0;
+	cellDimensionReciprocal = 0;
+	maxBound = 0;
+}
+
+void InteractionField::Clear() {
+	points.clear();
+	lines.clear();
+	cellStart.clear();
+	cellsPerAxis = 0;
+}
+
+void InteractionField::Add(const InteractionSource& source) {
+	float radiusSquared = source.radius * source.radius;
+
+	if (source.type == InteractionSource::Type::Point) {
+		points.push_back({ source.start, radiusSquared, source.strength });
+	}
+	else {
+		Vector3 line = source.end - source.start;
+		float lengthSquared = line.LengthSquared();
+		lines.push_back({ source.start, line, lengthSquared > 0 ? 1.0f / lengthSquared : 0.0f, radiusSquared, source.strength });
+	}
+}
+
+void InteractionField::Build(float bound) {
+	maxBound = bound;
+	cellsPerAxis = 0;
+
+	if ((int)points.size() <= bucketThreshold) {
+		return;
+	}
+
+	// Cells are at least as wide as the largest source radius, so the 27 cells around an agent hold every source that can reach it
+	float maxRadiusSquared = 0;
+	for (const PointSource& p : points) {
+		maxRadiusSquared = fmax(maxRadiusSquared, p.radiusSquared);
+	}
+	float maxRadius = sqrt(maxRadiusSquared);
+
+	cellsPerAxis = (int)Maths::Clamp(maxRadius > 0 ? (2 * maxBound) / maxRadius : 1.0f, 1.0f, 64.0f);
+	cellDimensionReciprocal = cellsPerAxis / (2 * maxBound);
+
+	int numCells = cellsPerAxis * cellsPerAxis * cellsPerAxis;
+	cellStart.assign(numCells + 1, 0);
+
+	for (const PointSource& p : points) {
+		cellStart[CellIndex(p.position) + 1]++;
+	}
+	for (int i = 0; i < numCells; ++i) {
+		cellStart[i + 1] += cellStart[i];
+	}
+
+	bucketedPoints.resize(points.size());
+	std::vector<int> cursor(cellStart.begin(), cellStart.end() - 1);
+	for (const PointSource& p : points) {
+		bucketedPoints[cursor[CellIndex(p.position)]++] = p;
+	}
+	points.swap(bucketedPoints);
+}
+
+Vector3 InteractionField::Evaluate(const Vector3& position) const {
+	Vector3 steering(0, 0, 0);
+
+	for (const LineSource& l : lines) {
+		float t = Maths::Clamp(Vector3::Dot(position - l.start, l.line) * l.lineReciprocal, 0.0f, 1.0f);
+		Vector3 offset = position - (l.start + l.line * t);
+		float distance = offset.LengthSquared();
+
+		if (distance < l.radiusSquared) {
+			steering += offset * (1.0f - (distance / l.radiusSquared)) * l.strength;
+		}
+	}
+
+	if (cellsPerAxis == 0) {
+		for (const PointSource& p : points) {
+			Vector3 offset = position - p.position;
+			float distance = offset.LengthSquared();
+
+			if (distance < p.radiusSquared) {
+				steering += offset * (1.0f - (distance / p.radiusSquared)) * p.strength;
+			}
+		}
+		return steering;
+	}
+
+	int cell = CellIndex(position);
+	int z = cell / (cellsPerAxis * cellsPerAxis);
+	int y = (cell / cellsPerAxis) % cellsPerAxis;
+	int x = cell % cellsPerAxis;
+
+	for (int dz = -1; dz <= 1; ++dz) {
+		for (int dy = -1; dy <= 1; ++dy) {
+			for (int dx = -1; dx <= 1; ++dx) {
+				EvaluateCell(x + dx, y + dy, z + dz, position, steering);
+			}
+		}
+	}
+	return steering;
+}
+
+int InteractionField::CellIndex(const Vector3& position) const {
+	int x = Maths::Clamp((int)((position.x + maxBound) * cellDimensionReciprocal), 0, cellsPerAxis - 1);
+	int y = Maths::Clamp((int)((position.y + maxBound) * cellDimensionReciprocal), 0, cellsPerAxis - 1);
+	int z = Maths::Clamp((int)((position.z + maxBound) * cellDimensionReciprocal), 0, cellsPerAxis - 1);
+	return x + y * cellsPerAxis + z * cellsPerAxis * cellsPerAxis;
+}
+
+void InteractionField::EvaluateCell(int x, int y, int z, const Vector3& position, Vector3& steering) const {
+	if (x < 0 || y < 0 || z < 0 || x >= cellsPerAxis || y >= cellsPerAxis || z >= cellsPerAxis) {
+		return;
+	}
+	int cell = x + y * cellsPerAxis + z * cellsPerAxis * cellsPerAxis;
+
+	for (int i = cellStart[cell]; i < cellStart[cell + 1]; ++i) {
+		const PointSource& p = points[i];
+		Vector3 offset = position - p.position;
+		float distance = offset.LengthSquared();
+
+		if (distance < p.radiusSquared) {
+			steering += offset * (1.0f - (distance / p.radiusSquared)) * p.strength;
+		}
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "../Common/Vector3.h"
+#include <vector>
+
+namespace NCL {
+	using namespace NCL::Maths;
+
+	// Positive strength pushes agents away from the source, negative strength pulls them in
+	struct InteractionSource {
+		enum class Type {
+			Point,
+			Line
+		};
+
+		static InteractionSource Attractor(const Vector3& position, float radius, float strength = 1.0f) {
+			return { Type::Point, position, position, radius, -strength };
+		}
+
+		static InteractionSource Repulsor(const Vector3& position, float radius, float strength = 1.0f) {
+			return { Type::Point, position, position, radius, strength };
+		}
+
+		static InteractionSource Line(const Vector3& start, const Vector3& end, float radius, float strength = 1.0f) {
+			return { Type::Line, start, end, radius, strength };
+		}
+
+		Type type;
+		Vector3 start;
+		Vector3 end;
+		float radius;
+		float strength;
+	};
+
+	// Interaction sources are gathered once per step. Point sources are bucketed into a uniform grid
+	// once there are enough of them, so each agent only evaluates the sources in its own neighbourhood.
+	class InteractionField {
+	public:
+		InteractionField();
+		~InteractionField() {}
+
+		void Clear();
+		void Add(const InteractionSource& source);
+		void Build(float maxBound);
+
+		Vector3 Evaluate(const Vector3& position) const;
+
+		int NumSources() const {
+			return (int)(points.size() + lines.size());
+		}
+
+	protected:
+		struct PointSource {
+			Vector3 position;
+			float radiusSquared;
+			float strength;
+		};
+
+		struct LineSource {
+			Vector3 start;
+			Vector3 line;
+			float lineReciprocal;
+			float radiusSquared;
+			float strength;
+		};
+
+		int CellIndex(const Vector3& position) const;
+		void EvaluateCell(int x, int y, int z, const Vector3& position, Vector3& steering) const;
+
+		std::vector<PointSource> points;
+		std::vector<LineSource> lines;
+
+		std::vector<PointSource> bucketedPoints;
+		std::vector<int> cellStart;
+
+		int bucketThreshold;
+		int cellsPerAxis;
+		float cellDimensionReciprocal;
+		float maxBound;
+	};
+}
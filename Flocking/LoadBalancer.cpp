@@ -0,0 +1,49 @@
+#include "LoadBalancer.h"
+
+using namespace NCL;
+
+LoadBalancer::LoadBalancer(float threshold, int interval) {
+	this->threshold = threshold;
+	this->interval = interval;
+	stepsSinceRebalance = 0;
+}
+
+float LoadBalancer::Imbalance(const std::vector<double>& partitionCosts) {
+	double total = 0;
+	double highest = 0;
+	for (double cost : partitionCosts) {
+		total += cost;
+		highest = cost > highest ? cost : highest;
+	}
+	return total > 0 ? (float)(highest * partitionCosts.size() / total) : 1.0f;
+}
+
+bool LoadBalancer::Due(float imbalance) {
+	stepsSinceRebalance++;
+	return Enabled() && stepsSinceRebalance >= interval && imbalance > 1.0f + threshold;
+}
+
+void LoadBalancer::Rebalanced() {
+	stepsSinceRebalance = 0;
+}
+
+void LoadBalancer::SplitByCost(const std::vector<float>& sortedCosts, int parts, std::vector<int>& boundaries) {
+	int count = (int)sortedCosts.size();
+	double total = 0;
+	for (float cost : sortedCosts) {
+		total += cost;
+	}
+
+	boundaries.assign(parts + 1, count);
+	boundaries[0] = 0;
+
+	double running = 0;
+	int part = 1;
+	for (int i = 0; i < count && part < parts; ++i) {
+		// A part ends at the agent that takes it past its share
+		while (part < parts && running >= total * part / parts) {
+			boundaries[part++] = i;
+		}
+		running += sortedCosts[i];
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+
+namespace NCL {
+	// Decides when slab partitions should be redrawn and where, from a measured cost per agent. Partitions
+	// are only redrawn once the busiest is more than threshold above the mean, and never twice within
+	// interval steps, so the costs can settle after a move before they are judged again.
+	class LoadBalancer {
+	public:
+		LoadBalancer(float threshold, int interval);
+
+		// Busiest partition's cost over the mean, 1 when perfectly balanced
+		static float Imbalance(const std::vector<double>& partitionCosts);
+
+		// Call once per step. True when the partitions are worth redrawing.
+		bool Due(float imbalance);
+		void Rebalanced();
+
+		// Cuts costs, in the order of the agents along the split axis, into parts runs of equal total cost.
+		// boundaries[p] is the first agent of part p, and boundaries[parts] is the agent count.
+		static void SplitByCost(const std::vector<float>& sortedCosts, int parts, std::vector<int>& boundaries);
+
+		bool Enabled() const {
+			return threshold > 0;
+		}
+
+	protected:
+		float threshold;
+		int interval;
+		int stepsSinceRebalance;
+	};
+}
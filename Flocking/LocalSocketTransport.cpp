@@ -0,0 +1,246 @@
+#include "LocalSocketTransport.h"
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <fcntl.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace NCL;
+
+namespace {
+#ifdef _WIN32
+	typedef SOCKET NativeSocket;
+	const int sendFlags = 0;
+
+	void CloseSocket(NativeSocket s) {
+		closesocket(s);
+	}
+
+	void SetNonBlocking(NativeSocket s) {
+		u_long enabled = 1;
+		ioctlsocket(s, FIONBIO, &enabled);
+	}
+
+	bool WouldBlock() {
+		return WSAGetLastError() == WSAEWOULDBLOCK;
+	}
+#else
+	typedef int NativeSocket;
+	const NativeSocket INVALID_SOCKET = -1;
+	// A peer that has gone away shows up as a failed send rather than a SIGPIPE
+	const int sendFlags = MSG_NOSIGNAL;
+
+	void CloseSocket(NativeSocket s) {
+		close(s);
+	}
+
+	void SetNonBlocking(NativeSocket s) {
+		fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+	}
+
+	bool WouldBlock() {
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+	}
+#endif
+
+	const uintptr_t noSocket = (uintptr_t)INVALID_SOCKET;
+
+	sockaddr_un SocketAddress(const std::string& path) {
+		sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+		return address;
+	}
+
+	// Progress of one peer's message in either direction: the length prefix, then the payload
+	struct Transfer {
+		uint32_t length;
+		size_t done;
+	};
+}
+
+LocalSocketTransport::LocalSocketTransport(const std::string& path, int rank, int ranks) {
+	this->path = path;
+	this->rank = rank;
+	this->ranks = ranks;
+	sockets.assign(ranks, noSocket);
+
+#ifdef _WIN32
+	WSADATA data;
+	WSAStartup(MAKEWORD(2, 2), &data);
+#endif
+
+	// A socket file left behind by an earlier run would make bind fail
+	std::string ownPath = SocketPath(rank);
+	remove(ownPath.c_str());
+
+	NativeSocket s = socket(AF_UNIX, SOCK_STREAM, 0);
+	sockaddr_un address = SocketAddress(ownPath);
+	if (s == INVALID_SOCKET || bind(s, (sockaddr*)&address, sizeof(address)) != 0 || listen(s, ranks) != 0) {
+		Fail("can't listen on " + ownPath);
+	}
+	listener = (uintptr_t)s;
+}
+
+LocalSocketTransport::~LocalSocketTransport() {
+	for (Socket s : sockets) {
+		if (s != noSocket) {
+			CloseSocket((NativeSocket)s);
+		}
+	}
+	CloseSocket((NativeSocket)listener);
+	remove(SocketPath(rank).c_str());
+
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+std::string LocalSocketTransport::SocketPath(int forRank) const {
+	return path + "-" + std::to_string(forRank);
+}
+
+// The peer may not have started yet, so its socket is retried until it appears. A connect completes
+// once the peer is listening, before it accepts, so ranks connecting to each other can't wait in a cycle.
+void LocalSocketTransport::Connect(int peer) {
+	sockaddr_un address = SocketAddress(SocketPath(peer));
+	NativeSocket s = INVALID_SOCKET;
+
+	while (true) {
+		s = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (s == INVALID_SOCKET) {
+			Fail("can't create a socket");
+		}
+		if (connect(s, (sockaddr*)&address, sizeof(address)) == 0) {
+			break;
+		}
+		CloseSocket(s);
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+
+	// The accepting side learns who connected from the first four bytes
+	int32_t id = rank;
+	if (send(s, (const char*)&id, sizeof(id), sendFlags) != sizeof(id)) {
+		Fail("lost rank " + std::to_string(peer) + " while connecting");
+	}
+	SetNonBlocking(s);
+	sockets[peer] = (uintptr_t)s;
+}
+
+// Higher ranks connect in whatever order they start, so connections for other peers are kept for later
+void LocalSocketTransport::Accept(int peer) {
+	while (sockets[peer] == noSocket) {
+		NativeSocket s = accept((NativeSocket)listener, nullptr, nullptr);
+		int32_t id = -1;
+		if (s == INVALID_SOCKET || recv(s, (char*)&id, sizeof(id), MSG_WAITALL) != sizeof(id) || id <= rank || id >= ranks) {
+			Fail("bad connection while waiting for rank " + std::to_string(peer));
+		}
+		SetNonBlocking(s);
+		sockets[id] = (uintptr_t)s;
+	}
+}
+
+void LocalSocketTransport::Fail(const std::string& message) const {
+	std::cout << "Domain rank " << rank << ": " << message << std::endl;
+	exit(1);
+}
+
+void LocalSocketTransport::Exchange(const std::vector<int>& peers, const std::vector<std::vector<char>>& outgoing, std::vector<std::vector<char>>& incoming) {
+	int count = (int)peers.size();
+	incoming.resize(count);
+
+	for (int peer : peers) {
+		if (sockets[peer] == noSocket && peer < rank) {
+			Connect(peer);
+		}
+	}
+	for (int peer : peers) {
+		if (sockets[peer] == noSocket) {
+			Accept(peer);
+		}
+	}
+
+	std::vector<Transfer> sending(count);
+	std::vector<Transfer> receiving(count);
+	for (int i = 0; i < count; ++i) {
+		sending[i].length = (uint32_t)outgoing[i].size();
+		sending[i].done = 0;
+		receiving[i].length = 0;
+		receiving[i].done = 0;
+	}
+	const size_t prefix = sizeof(uint32_t);
+
+	int pending = 2 * count;
+	while (pending > 0) {
+		fd_set readable;
+		fd_set writable;
+		FD_ZERO(&readable);
+		FD_ZERO(&writable);
+		NativeSocket highest = 0;
+
+		for (int i = 0; i < count; ++i) {
+			NativeSocket s = (NativeSocket)sockets[peers[i]];
+			if (sending[i].done < prefix + sending[i].length) {
+				FD_SET(s, &writable);
+			}
+			if (receiving[i].done < prefix || receiving[i].done < prefix + receiving[i].length) {
+				FD_SET(s, &readable);
+			}
+			highest = s > highest ? s : highest;
+		}
+		if (select((int)highest + 1, &readable, &writable, nullptr, nullptr) < 0) {
+			if (WouldBlock()) {
+				continue;
+			}
+			Fail("select failed");
+		}
+
+		for (int i = 0; i < count; ++i) {
+			NativeSocket s = (NativeSocket)sockets[peers[i]];
+
+			Transfer& out = sending[i];
+			if (FD_ISSET(s, &writable)) {
+				const char* data = out.done < prefix ? (const char*)&out.length + out.done : outgoing[i].data() + (out.done - prefix);
+				size_t size = out.done < prefix ? prefix - out.done : prefix + out.length - out.done;
+
+				int sent = (int)send(s, data, (int)size, sendFlags);
+				if (sent < 0 && !WouldBlock()) {
+					Fail("lost rank " + std::to_string(peers[i]));
+				}
+				out.done += sent > 0 ? sent : 0;
+				pending -= out.done == prefix + out.length ? 1 : 0;
+			}
+
+			Transfer& in = receiving[i];
+			if (FD_ISSET(s, &readable)) {
+				char* data = in.done < prefix ? (char*)&in.length + in.done : incoming[i].data() + (in.done - prefix);
+				size_t size = in.done < prefix ? prefix - in.done : prefix + in.length - in.done;
+
+				int received = (int)recv(s, data, (int)size, 0);
+				if (received == 0 || (received < 0 && !WouldBlock())) {
+					Fail("lost rank " + std::to_string(peers[i]));
+				}
+				in.done += received > 0 ? received : 0;
+				if (in.done == prefix) {
+					incoming[i].resize(in.length);
+				}
+				pending -= in.done == prefix + in.length ? 1 : 0;
+			}
+		}
+	}
+}
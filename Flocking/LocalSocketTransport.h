@@ -0,0 +1,43 @@
+#pragma once
+
+#include "DomainTransport.h"
+#include <cstdint>
+#include <string>
+
+namespace NCL {
+	// Ranks on one host connected by Unix domain sockets (AF_UNIX, which Windows 10 has too). Each rank
+	// listens on path-<rank>, and the first exchange with a peer connects to it if the peer has the lower
+	// rank or accepts it otherwise. Messages are length prefixed, and every socket is written and read
+	// together in a select loop, so two ranks sending each other large messages can't deadlock.
+	class LocalSocketTransport : public DomainTransport {
+	public:
+		LocalSocketTransport(const std::string& path, int rank, int ranks);
+		~LocalSocketTransport();
+
+		int Rank() const override {
+			return rank;
+		}
+
+		int NumRanks() const override {
+			return ranks;
+		}
+
+		void Exchange(const std::vector<int>& peers, const std::vector<std::vector<char>>& outgoing, std::vector<std::vector<char>>& incoming) override;
+
+	protected:
+		// Wide enough for a Windows SOCKET or a POSIX descriptor
+		typedef uintptr_t Socket;
+
+		std::string SocketPath(int forRank) const;
+		void Connect(int peer);
+		void Accept(int peer);
+		void Fail(const std::string& message) const;
+
+		std::string path;
+		int rank;
+		int ranks;
+
+		Socket listener;
+		std::vector<Socket> sockets;
+	};
+}
@@ -4,6 +4,8 @@
 #include "SimulationGPU.h"
 #include "FlockingRenderer.h"
 #include "SettingsLoader.h"
+#include "FlockViewer.h"
+#include "TrajectoryPlayer.h"
 
 using namespace NCL;
 using namespace std;
@@ -52,7 +54,59 @@ SimulationType SimulationMenu(FlockingRenderer* renderer) {
 	return type;
 }
 
-int main() {
+// The value following flag on the command line, or an empty string
+std::string ArgumentValue(int argc, char** argv, const std::string& flag) {
+	for (int i = 1; i + 1 < argc; ++i) {
+		if (flag == argv[i]) {
+			return argv[i + 1];
+		}
+	}
+	return "";
+}
+
+// Every rank of a domain decomposition reads the same settings file, so each is given its rank on the command line.
+// A run resumed from a checkpoint takes the settings it was saved with instead.
+Simulation::Settings LoadSettings(SettingsLoader& loader, const std::string& filename, int argc, char** argv, CheckpointReader* checkpoint) {
+	Simulation::Settings settings;
+	if (!checkpoint || !Simulation::ReadSettings(*checkpoint, settings)) {
+		settings = loader.LoadSettingsFromFile(filename);
+	}
+	std::string rank = ArgumentValue(argc, argv, "-domainRank");
+	if (!rank.empty()) {
+		settings.domainRank = atoi(rank.c_str());
+	}
+	return settings;
+}
+
+// -view <name> draws the flock another process publishes under sharedStateName instead of simulating one
+int RunViewer(Window* w, FlockingRenderer* renderer, const std::string& stateName) {
+	FlockViewer viewer(stateName, renderer);
+
+	w->GetTimer()->GetTimeDeltaSeconds();
+	while (w->UpdateWindow() && !Window::GetKeyboard()->KeyDown(KeyboardKeys::ESCAPE)) {
+		float dt = w->GetTimer()->GetTimeDeltaSeconds();
+		w->SetTitle("Viewer Frame Time: " + std::to_string(1000.0f * dt));
+		viewer.Update(dt);
+	}
+	Window::DestroyGameWindow();
+	return 0;
+}
+
+// -replay <file> plays back a trajectory recorded with trajectoryFile instead of simulating
+int RunReplay(Window* w, FlockingRenderer* renderer, const std::string& filename) {
+	TrajectoryPlayer player(filename, renderer);
+
+	w->GetTimer()->GetTimeDeltaSeconds();
+	while (w->UpdateWindow() && !Window::GetKeyboard()->KeyDown(KeyboardKeys::ESCAPE)) {
+		float dt = w->GetTimer()->GetTimeDeltaSeconds();
+		w->SetTitle("Replay Frame Time: " + std::to_string(1000.0f * dt));
+		player.Update(dt);
+	}
+	Window::DestroyGameWindow();
+	return 0;
+}
+
+int main(int argc, char** argv) {
 	Window*w = Window::CreateGameWindow("CPU vs GPU Flocking Project", 1920, 1080);
 
 	if (!w->HasInitialised()) {
@@ -65,21 +119,39 @@ int main() {
 
 	SettingsLoader loader;
 	FlockingRenderer* renderer = new FlockingRenderer();
+
+	std::string viewName = ArgumentValue(argc, argv, "-view");
+	if (!viewName.empty()) {
+		return RunViewer(w, renderer, viewName);
+	}
+	std::string replayName = ArgumentValue(argc, argv, "-replay");
+	if (!replayName.empty()) {
+		return RunReplay(w, renderer, replayName);
+	}
 	SimulationType selectedSimulation = SimulationMenu(renderer);
 
+	// -restore <file> resumes the run a checkpoint was saved from
+	std::string restoreName = ArgumentValue(argc, argv, "-restore");
+	CheckpointReader* checkpoint = restoreName.empty() ? nullptr : new CheckpointReader(restoreName);
+
 	Simulation* sim;
 	if (selectedSimulation == CPU_OCTREE) {
-		sim = new SimulationCPU(true, loader.LoadSettingsFromFile("SimSettingsCPU-Octree.txt"), renderer);
+		sim = new SimulationCPU(true, LoadSettings(loader, "SimSettingsCPU-Octree.txt", argc, argv, checkpoint), renderer);
 	}
 	else if (selectedSimulation == GPU_BRUTE_FORCE) {
-		sim = new SimulationGPU(false, loader.LoadSettingsFromFile("SimSettingsGPU-BruteForce.txt"), renderer);
+		sim = new SimulationGPU(false, LoadSettings(loader, "SimSettingsGPU-BruteForce.txt", argc, argv, checkpoint), renderer);
 	}
 	else if (selectedSimulation == GPU_GRID) {
-		sim = new SimulationGPU(true, loader.LoadSettingsFromFile("SimSettingsGPU-Grid.txt"), renderer);
+		sim = new SimulationGPU(true, LoadSettings(loader, "SimSettingsGPU-Grid.txt", argc, argv, checkpoint), renderer);
 	}
 	else {
-		sim = new SimulationCPU(false, loader.LoadSettingsFromFile("SimSettingsCPU-BruteForce.txt"), renderer);
+		sim = new SimulationCPU(false, LoadSettings(loader, "SimSettingsCPU-BruteForce.txt", argc, argv, checkpoint), renderer);
+	}
+
+	if (checkpoint && checkpoint->Valid() && sim->LoadCheckpoint(*checkpoint)) {
+		std::cout << "Resumed from checkpoint " << restoreName << std::endl;
 	}
+	delete checkpoint;
 
 	w->GetTimer()->GetTimeDeltaSeconds();
 	while (w->UpdateWindow() && !Window::GetKeyboard()->KeyDown(KeyboardKeys::ESCAPE)) {
@@ -96,5 +168,7 @@ int main() {
 
 		sim->Update(dt);
 	}
+	// Closes the trajectory and shared state, and frees the GL buffers while the window's context still exists
+	delete sim;
 	Window::DestroyGameWindow();
 }
@@ -0,0 +1,339 @@
+#include "NumaPartitioner.h"
+#include "Flock.h"
+#include <algorithm>
+#include <cfloat>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+using namespace NCL;
+
+namespace {
+	// Processors are numbered as group * 64 + index within the group
+	void PinCurrentThread(int processor) {
+#ifdef _WIN32
+		GROUP_AFFINITY affinity = {};
+		affinity.Group = (WORD)(processor / 64);
+		affinity.Mask = (KAFFINITY)1 << (processor % 64);
+		SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr);
+#else
+		(void)processor;
+#endif
+	}
+
+	// Pages are committed but not backed until first written, which is what lets each node claim its slab
+	void* ReserveUntouched(size_t bytes) {
+#ifdef _WIN32
+		return VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+		return ::operator new(bytes);
+#endif
+	}
+
+	void Release(void* memory) {
+#ifdef _WIN32
+		VirtualFree(memory, 0, MEM_RELEASE);
+#else
+		::operator delete(memory);
+#endif
+	}
+}
+
+NumaPartitioner::NumaPartitioner(float balanceThreshold, int balanceInterval) : balancer(balanceThreshold, balanceInterval) {
+	agents = nullptr;
+	imbalance = 1.0f;
+	agentCount = 0;
+	storageBytes = 0;
+
+	QueryTopology();
+
+	for (Node& node : nodes) {
+		std::vector<int> processors = node.processors;
+		node.pool = new ThreadPool((int)processors.size() + 1, [processors](int index) {
+			PinCurrentThread(processors[index - 1]);
+		});
+	}
+	ResetStats();
+}
+
+NumaPartitioner::~NumaPartitioner() {
+	for (Node& node : nodes) {
+		delete node.pool;
+	}
+	if (agents) {
+		Release(agents);
+	}
+}
+
+void NumaPartitioner::QueryTopology() {
+#ifdef _WIN32
+	ULONG highestNode = 0;
+	GetNumaHighestNodeNumber(&highestNode);
+
+	for (ULONG n = 0; n <= highestNode; ++n) {
+		GROUP_AFFINITY mask = {};
+		if (!GetNumaNodeProcessorMaskEx((USHORT)n, &mask) || mask.Mask == 0) {
+			continue;
+		}
+		Node node;
+		for (int bit = 0; bit < 64; ++bit) {
+			if (mask.Mask & ((KAFFINITY)1 << bit)) {
+				node.processors.push_back(mask.Group * 64 + bit);
+			}
+		}
+		nodes.push_back(node);
+	}
+#endif
+	// Without NUMA information everything is one node, and the partitioner behaves like a plain thread pool
+	if (nodes.empty()) {
+		Node node;
+		int processorCount = (int)std::thread::hardware_concurrency();
+		for (int i = 0; i < processorCount; ++i) {
+			node.processors.push_back(i);
+		}
+		nodes.push_back(node);
+	}
+}
+
+void NumaPartitioner::Distribute(Flock* flock) {
+	const Agent* source = flock->agents;
+	int count = flock->Size();
+	agentCount = count;
+	storageBytes = count * sizeof(Agent);
+	agents = (Agent*)ReserveUntouched(storageBytes);
+
+	std::vector<int> order(count);
+	for (int i = 0; i < count; ++i) {
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [source](int a, int b) {
+		return source[a].position.x < source[b].position.x;
+	});
+
+	int nodeCount = (int)nodes.size();
+	begins.resize(nodeCount + 1);
+	for (int n = 0; n <= nodeCount; ++n) {
+		begins[n] = (int)((long long)n * count / nodeCount);
+	}
+
+	ForEachPartition([&](int, int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			agents[i] = source[order[i]];
+		}
+	});
+	homes = begins;
+
+	splits.resize(nodeCount - 1);
+	for (int n = 0; n < (int)splits.size(); ++n) {
+		splits[n] = SplitAt(PartitionBegin(n + 1));
+	}
+
+	std::vector<int> ids(count);
+	for (int i = 0; i < count; ++i) {
+		ids[i] = flock->agentIds[order[i]];
+	}
+	flock->UseExternalStorage(agents);
+	for (int i = 0; i < count; ++i) {
+		flock->agentIds[i] = ids[i];
+		flock->agentSlots[ids[i]] = i;
+	}
+}
+
+void NumaPartitioner::ForEachPartition(const std::function<void(int node, int begin, int end)>& job) {
+	std::vector<ThreadPool::TaskGroup> groups(nodes.size());
+
+	for (int n = 0; n < (int)nodes.size(); ++n) {
+		int begin = PartitionBegin(n);
+		int end = PartitionBegin(n + 1);
+		int chunkCount = nodes[n].pool->NumThreads() * 4;
+		int chunkSize = (end - begin + chunkCount - 1) / chunkCount;
+
+		for (int chunkBegin = begin; chunkBegin < end; chunkBegin += chunkSize) {
+			int chunkEnd = chunkBegin + chunkSize < end ? chunkBegin + chunkSize : end;
+			nodes[n].pool->Run(groups[n], [&job, n, chunkBegin, chunkEnd]() {
+				job(n, chunkBegin, chunkEnd);
+			});
+		}
+	}
+	// The calling thread doesn't help out, as it would be touching a slab from whichever node it runs on
+	for (ThreadPool::TaskGroup& group : groups) {
+		while (group.pending.load() > 0) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+void NumaPartitioner::ForEachNode(const std::function<void(int node)>& job) {
+	std::vector<ThreadPool::TaskGroup> groups(nodes.size());
+
+	for (int n = 0; n < (int)nodes.size(); ++n) {
+		nodes[n].pool->Run(groups[n], [&job, n]() {
+			job(n);
+		});
+	}
+	for (ThreadPool::TaskGroup& group : groups) {
+		while (group.pending.load() > 0) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+void NumaPartitioner::Swap(Flock* flock, int slotA, int slotB) {
+	std::swap(agents[slotA], agents[slotB]);
+	std::swap(flock->agentIds[slotA], flock->agentIds[slotB]);
+	flock->agentSlots[flock->agentIds[slotA]] = slotA;
+	flock->agentSlots[flock->agentIds[slotB]] = slotB;
+
+	if (onSwap) {
+		onSwap(slotA, slotB);
+	}
+}
+
+// Midway between the agents either side of a slab boundary. With fewer agents than nodes some slabs are empty,
+// and their boundaries sit on the nearest agent instead.
+float NumaPartitioner::SplitAt(int boundary) const {
+	if (agentCount == 0) {
+		return 0.0f;
+	}
+	int below = std::max(boundary - 1, 0);
+	int above = std::min(boundary, agentCount - 1);
+	return (agents[below].position.x + agents[above].position.x) * 0.5f;
+}
+
+void NumaPartitioner::Migrate(Flock* flock) {
+	int nodeCount = (int)nodes.size();
+	if (nodeCount < 2) {
+		lastMigrated = 0;
+		return;
+	}
+
+	// Each node finds its own agents that now belong to the slab on either side
+	std::vector<std::vector<int>> movingDown(nodeCount);
+	std::vector<std::vector<int>> movingUp(nodeCount);
+
+	ForEachNode([&](int n) {
+		for (int i = PartitionBegin(n); i < PartitionBegin(n + 1); ++i) {
+			float x = agents[i].position.x;
+			if (n > 0 && x < splits[n - 1]) {
+				movingDown[n].push_back(i);
+			}
+			else if (n < nodeCount - 1 && x >= splits[n]) {
+				movingUp[n].push_back(i);
+			}
+		}
+	});
+
+	// Slabs keep a fixed size, so agents can only move in pairs across a boundary
+	int migrated = 0;
+	std::vector<char> drifted(nodeCount - 1, 0);
+	bool anyDrifted = false;
+	for (int n = 0; n < nodeCount - 1; ++n) {
+		const std::vector<int>& up = movingUp[n];
+		const std::vector<int>& down = movingDown[n + 1];
+		int pairs = (int)(up.size() < down.size() ? up.size() : down.size());
+
+		for (int p = 0; p < pairs; ++p) {
+			Swap(flock, up[p], down[p]);
+		}
+		migrated += pairs * 2;
+
+		// Unpaired crossers mean the flock has drifted, so the boundary follows it
+		drifted[n] = pairs < (int)up.size() || pairs < (int)down.size();
+		anyDrifted |= drifted[n] != 0;
+	}
+	lastMigrated = migrated;
+
+	if (!anyDrifted) {
+		return;
+	}
+	// Drifted boundaries are re-centred between the slabs as they are after the swaps, with the agents that
+	// crossed in counted and the ones that crossed out not
+	std::vector<float> lowestX(nodeCount);
+	std::vector<float> highestX(nodeCount);
+	ForEachNode([&](int n) {
+		float lowest = FLT_MAX;
+		float highest = -FLT_MAX;
+		for (int i = PartitionBegin(n); i < PartitionBegin(n + 1); ++i) {
+			float x = agents[i].position.x;
+			lowest = x < lowest ? x : lowest;
+			highest = x > highest ? x : highest;
+		}
+		lowestX[n] = lowest;
+		highestX[n] = highest;
+	});
+	for (int n = 0; n < nodeCount - 1; ++n) {
+		if (drifted[n] && PartitionBegin(n) < PartitionBegin(n + 1) && PartitionBegin(n + 1) < PartitionBegin(n + 2)) {
+			splits[n] = (highestX[n] + lowestX[n + 1]) * 0.5f;
+		}
+	}
+}
+
+// Slabs are cut at cost quantiles along x, so a dense clump is shared between nodes rather than landing on one
+void NumaPartitioner::Rebalance(Flock* flock, const std::vector<float>& agentCosts) {
+	int nodeCount = (int)nodes.size();
+	std::vector<double> costs(nodeCount, 0.0);
+	for (int n = 0; n < nodeCount; ++n) {
+		for (int i = PartitionBegin(n); i < PartitionBegin(n + 1); ++i) {
+			costs[n] += agentCosts[i];
+		}
+	}
+	imbalance = LoadBalancer::Imbalance(costs);
+
+	// Every slab needs an agent of its own once it is cut by cost
+	if (nodeCount < 2 || agentCount < nodeCount || !balancer.Due(imbalance)) {
+		return;
+	}
+
+	std::vector<int> order(agentCount);
+	for (int i = 0; i < agentCount; ++i) {
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [this](int a, int b) {
+		return agents[a].position.x < agents[b].position.x;
+	});
+
+	std::vector<float> sortedCosts(agentCount);
+	for (int i = 0; i < agentCount; ++i) {
+		sortedCosts[i] = agentCosts[order[i]];
+	}
+	LoadBalancer::SplitByCost(sortedCosts, nodeCount, begins);
+
+	// Slot i takes the agent from slot order[i], a cycle at a time, so everything kept per slot follows it
+	for (int i = 0; i < agentCount; ++i) {
+		int j = i;
+		while (order[j] != i) {
+			int next = order[j];
+			Swap(flock, j, next);
+			order[j] = j;
+			j = next;
+		}
+		order[j] = j;
+	}
+
+	// Every slab keeps at least one agent, so the splits stay ordered
+	for (int n = 1; n < nodeCount; ++n) {
+		begins[n] = std::max(begins[n], begins[n - 1] + 1);
+	}
+	for (int n = nodeCount - 1; n > 0; --n) {
+		begins[n] = std::min(begins[n], begins[n + 1] - 1);
+	}
+	for (int n = 0; n < nodeCount - 1; ++n) {
+		splits[n] = SplitAt(begins[n + 1]);
+	}
+	balancer.Rebalanced();
+}
+
+float NumaPartitioner::LocalAccessRatio() const {
+	long long local = localAccesses.load();
+	long long total = local + remoteAccesses.load();
+	return total > 0 ? (float)local / (float)total : 1.0f;
+}
+
+void NumaPartitioner::ResetStats() {
+	localAccesses = 0;
+	remoteAccesses = 0;
+	lastMigrated = 0;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "LoadBalancer.h"
+#include "ThreadPool.h"
+#include <atomic>
+#include <functional>
+#include <vector>
+
+namespace NCL {
+	struct Agent;
+	class Flock;
+
+	// Splits the flock into one slab along x per NUMA node. The agents live in a single array whose equal
+	// ranges are first touched by each node's pinned threads, so each node's home range is in its own
+	// memory, and every slab starts out as its node's home. Agents that cross a slab boundary are swapped
+	// with agents crossing the other way, and the boundary is re-centred, so the slabs only move when they
+	// are rebalanced. The home ranges never move.
+	class NumaPartitioner {
+	public:
+		NumaPartitioner(float balanceThreshold, int balanceInterval);
+		~NumaPartitioner();
+
+		int NumNodes() const {
+			return (int)nodes.size();
+		}
+
+		// Moves the flock's agents into freshly reserved storage, sorted into slabs, with each slab written by
+		// its own node. The flock's ids follow their agents.
+		void Distribute(Flock* flock);
+
+		// Runs job(node, begin, end) over every slab's agents on that slab's node and blocks until all are done
+		void ForEachPartition(const std::function<void(int node, int begin, int end)>& job);
+
+		// Swaps agents that have crossed into a neighbouring slab, one slab per call
+		void Migrate(Flock* flock);
+
+		// Called with every pair of slots Migrate swaps, so per slot data can follow its agent
+		void SetSwapCallback(const std::function<void(int slotA, int slotB)>& callback) {
+			onSwap = callback;
+		}
+
+		// Measures how evenly agentCosts, indexed like the agents, fall across the slabs, and once they are
+		// uneven enough re-sorts the agents by x and cuts slabs of equal cost. Slabs of unequal size reach
+		// into the home ranges of the nodes either side, which is the price of keeping every node busy.
+		// The agents move through the swap callback, and agentCosts may be one of the things it swaps.
+		void Rebalance(Flock* flock, const std::vector<float>& agentCosts);
+
+		// Whether the agent is stored in the node's own memory, wherever the slabs are
+		bool IsLocal(int node, int agentIndex) const {
+			return agentIndex >= homes[node] && agentIndex < homes[node + 1];
+		}
+
+		void RecordAccesses(int local, int remote) {
+			localAccesses += local;
+			remoteAccesses += remote;
+		}
+
+		// Share of neighbour reads since the last reset that hit the reading node's own slab
+		float LocalAccessRatio() const;
+		int LastMigrated() const {
+			return lastMigrated;
+		}
+		float Imbalance() const {
+			return imbalance;
+		}
+		void ResetStats();
+
+	protected:
+		struct Node {
+			std::vector<int> processors;
+			ThreadPool* pool;
+		};
+
+		int PartitionBegin(int node) const {
+			return begins[node];
+		}
+
+		void QueryTopology();
+		void ForEachNode(const std::function<void(int node)>& job);
+		void Swap(Flock* flock, int slotA, int slotB);
+		float SplitAt(int boundary) const;
+
+		std::vector<Node> nodes;
+		// splits[n] divides slab n from slab n + 1, and slab n holds agents begins[n] to begins[n + 1]
+		std::vector<float> splits;
+		std::vector<int> begins;
+		// Node n first touched agents homes[n] to homes[n + 1]
+		std::vector<int> homes;
+
+		LoadBalancer balancer;
+		std::atomic<float> imbalance;
+
+		Agent* agents;
+		int agentCount;
+		size_t storageBytes;
+
+		std::atomic<long long> localAccesses;
+		std::atomic<long long> remoteAccesses;
+		std::atomic<int> lastMigrated;
+
+		std::function<void(int slotA, int slotB)> onSwap;
+	};
+}
@@ -0,0 +1,413 @@
+#include "ObstacleField.h"
+#include "ThreadPool.h"
+#include "Debug.h"
+#include "../Common/Assets.h"
+#include "../Common/Maths.h"
+#include "../Common/MeshGeometry.h"
+#include "../Plugins/OpenGLRendering/OGLMesh.h"
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+using namespace NCL;
+
+namespace {
+	const char cacheMagic[4] = { 'S', 'D', 'F', 'C' };
+	const uint32_t cacheVersion = 2;
+
+	// Which part of a triangle the closest point landed on, indexing Triangle::pseudonormals
+	enum TriangleFeature {
+		VertexA, VertexB, VertexC, EdgeAB, EdgeBC, EdgeCA, Face
+	};
+
+	// Adapted from Real-Time Collision Detection (Ericson), 5.1.5
+	Vector3 ClosestPointOnTriangle(const Vector3& p, const Vector3& a, const Vector3& b, const Vector3& c, int& feature) {
+		Vector3 ab = b - a;
+		Vector3 ac = c - a;
+		Vector3 ap = p - a;
+
+		float d1 = Vector3::Dot(ab, ap);
+		float d2 = Vector3::Dot(ac, ap);
+		feature = VertexA;
+		if (d1 <= 0.0f && d2 <= 0.0f) return a;
+
+		Vector3 bp = p - b;
+		float d3 = Vector3::Dot(ab, bp);
+		float d4 = Vector3::Dot(ac, bp);
+		feature = VertexB;
+		if (d3 >= 0.0f && d4 <= d3) return b;
+
+		float vc = d1 * d4 - d3 * d2;
+		feature = EdgeAB;
+		if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return a + ab * (d1 / (d1 - d3));
+
+		Vector3 cp = p - c;
+		float d5 = Vector3::Dot(ab, cp);
+		float d6 = Vector3::Dot(ac, cp);
+		feature = VertexC;
+		if (d6 >= 0.0f && d5 <= d6) return c;
+
+		float vb = d5 * d2 - d1 * d6;
+		feature = EdgeCA;
+		if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return a + ac * (d2 / (d2 - d6));
+
+		float va = d3 * d6 - d5 * d4;
+		feature = EdgeBC;
+		if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+		feature = Face;
+		float denom = 1.0f / (va + vb + vc);
+		return a + ab * (vb * denom) + ac * (vc * denom);
+	}
+
+	float BoxDistance(const Vector3& p, const Vector3& center, const Vector3& halfSize) {
+		Vector3 q(fabs(p.x - center.x) - halfSize.x, fabs(p.y - center.y) - halfSize.y, fabs(p.z - center.z) - halfSize.z);
+		Vector3 outside(fmax(q.x, 0.0f), fmax(q.y, 0.0f), fmax(q.z, 0.0f));
+		return outside.Length() + fmin(q.GetMaxElement(), 0.0f);
+	}
+
+	uint64_t HashBytes(uint64_t hash, const void* data, size_t size) {
+		const unsigned char* bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < size; ++i) {
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+		return hash;
+	}
+}
+
+ObstacleField::ObstacleField() {
+	resolution = 64;
+	maxBound = 0;
+	spacingReciprocal = 0;
+}
+
+bool ObstacleField::LoadFromFile(const std::string& filename) {
+	std::string contents;
+	if (!Assets::ReadTextFile(Assets::DATADIR + filename, contents)) {
+		std::cout << "Error reading obstacle file " << filename << ". No obstacles added." << std::endl;
+		return false;
+	}
+
+	std::istringstream iss(contents);
+	std::string data;
+
+	while (std::getline(iss, data)) {
+		std::istringstream line(data);
+		std::string type;
+
+		if (!(line >> type) || type[0] == '#') {
+			continue;
+		}
+		if (type == "box") {
+			Vector3 center, halfSize;
+			line >> center.x >> center.y >> center.z >> halfSize.x >> halfSize.y >> halfSize.z;
+			AddBox(center, halfSize);
+		}
+		else if (type == "sphere") {
+			Vector3 center;
+			float radius;
+			line >> center.x >> center.y >> center.z >> radius;
+			AddSphere(center, radius);
+		}
+		else if (type == "mesh") {
+			std::string meshFile;
+			Vector3 position;
+			float scale;
+			line >> meshFile >> position.x >> position.y >> position.z >> scale;
+
+			Rendering::OGLMesh mesh(meshFile);
+			if (mesh.GetVertexCount() == 0) {
+				std::cout << "Obstacle mesh " << meshFile << " could not be loaded." << std::endl;
+				continue;
+			}
+			AddMesh(mesh, position, scale);
+		}
+		else {
+			std::cout << "Unknown obstacle type: " << type << std::endl;
+		}
+	}
+	std::cout << "Obstacles loaded: " << shapes.size() << " (" << triangles.size() << " mesh triangles)" << std::endl;
+	return !shapes.empty();
+}
+
+void ObstacleField::AddBox(const Vector3& center, const Vector3& halfSize) {
+	shapes.push_back({ ShapeType::Box, center, halfSize, 0, 0, 0 });
+}
+
+void ObstacleField::AddSphere(const Vector3& center, float radius) {
+	shapes.push_back({ ShapeType::Sphere, center, Vector3(1, 1, 1) * radius, radius, 0, 0 });
+}
+
+void ObstacleField::AddMesh(const MeshGeometry& mesh, const Vector3& position, float scale) {
+	Shape shape = { ShapeType::Mesh, Vector3(), Vector3(), 0, (int)triangles.size(), 0 };
+	Vector3 meshMin(FLT_MAX, FLT_MAX, FLT_MAX);
+	Vector3 meshMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+	Triangle t;
+	for (unsigned int i = 0; mesh.GetTriangle(i, t.a, t.b, t.c); ++i) {
+		t.a = position + t.a * scale;
+		t.b = position + t.b * scale;
+		t.c = position + t.c * scale;
+		t.pseudonormals[Face] = Vector3::Cross(t.b - t.a, t.c - t.a).Normalised();
+		triangles.push_back(t);
+
+		for (const Vector3& v : { t.a, t.b, t.c }) {
+			meshMin = Vector3(fmin(meshMin.x, v.x), fmin(meshMin.y, v.y), fmin(meshMin.z, v.z));
+			meshMax = Vector3(fmax(meshMax.x, v.x), fmax(meshMax.y, v.y), fmax(meshMax.z, v.z));
+		}
+	}
+	shape.triangleCount = (int)triangles.size() - shape.firstTriangle;
+	if (shape.triangleCount == 0) {
+		return;
+	}
+	shape.center = (meshMin + meshMax) * 0.5f;
+	shape.halfSize = (meshMax - meshMin) * 0.5f;
+	shapes.push_back(shape);
+
+	BuildPseudonormals(shape);
+}
+
+// Angle-weighted pseudonormals (Baerentzen and Aanaes), so the sign is right when the closest point is on an edge or vertex.
+// Vertices are welded by position, as meshes split them along UV and normal seams.
+void ObstacleField::BuildPseudonormals(const Shape& mesh) {
+	std::map<std::array<float, 3>, int> vertexIds;
+	std::vector<Vector3> vertexNormals;
+	std::map<std::pair<int, int>, Vector3> edgeNormals;
+	std::vector<std::array<int, 3>> corners(mesh.triangleCount);
+
+	for (int i = 0; i < mesh.triangleCount; ++i) {
+		Triangle& t = triangles[mesh.firstTriangle + i];
+		const Vector3* v[3] = { &t.a, &t.b, &t.c };
+		const Vector3& faceNormal = t.pseudonormals[Face];
+
+		for (int j = 0; j < 3; ++j) {
+			auto inserted = vertexIds.insert({ { v[j]->x, v[j]->y, v[j]->z }, (int)vertexNormals.size() });
+			if (inserted.second) {
+				vertexNormals.push_back(Vector3());
+			}
+			corners[i][j] = inserted.first->second;
+
+			Vector3 toNext = (*v[(j + 1) % 3] - *v[j]).Normalised();
+			Vector3 toPrevious = (*v[(j + 2) % 3] - *v[j]).Normalised();
+			float angle = acos(Clamp(Vector3::Dot(toNext, toPrevious), -1.0f, 1.0f));
+			vertexNormals[corners[i][j]] += faceNormal * angle;
+		}
+		for (int j = 0; j < 3; ++j) {
+			int from = corners[i][j];
+			int to = corners[i][(j + 1) % 3];
+			edgeNormals[{ std::min(from, to), std::max(from, to) }] += faceNormal;
+		}
+	}
+
+	for (int i = 0; i < mesh.triangleCount; ++i) {
+		Triangle& t = triangles[mesh.firstTriangle + i];
+		for (int j = 0; j < 3; ++j) {
+			int from = corners[i][j];
+			int to = corners[i][(j + 1) % 3];
+			t.pseudonormals[VertexA + j] = vertexNormals[from].Normalised();
+			t.pseudonormals[EdgeAB + j] = edgeNormals[{ std::min(from, to), std::max(from, to) }].Normalised();
+		}
+	}
+}
+
+void ObstacleField::Bake(float bound, ThreadPool* pool, const std::string& cacheFile) {
+	maxBound = bound;
+	spacingReciprocal = (resolution - 1) / (2 * maxBound);
+
+	if (shapes.empty()) {
+		samples.clear();
+		return;
+	}
+
+	uint64_t key = CacheKey();
+	if (!cacheFile.empty() && LoadCache(cacheFile, key)) {
+		std::cout << "Obstacle field loaded from cache: " << cacheFile << std::endl;
+		return;
+	}
+
+	samples.resize(resolution * resolution * resolution);
+	float spacing = 1.0f / spacingReciprocal;
+	int slice = resolution * resolution;
+
+	pool->ParallelFor(resolution, 1, [&](int begin, int end) {
+		for (int z = begin; z < end; ++z) {
+			for (int y = 0; y < resolution; ++y) {
+				for (int x = 0; x < resolution; ++x) {
+					Vector3 p = Vector3((float)x, (float)y, (float)z) * spacing - Vector3(1, 1, 1) * maxBound;
+					samples[x + y * resolution + z * slice].distance = Distance(p);
+				}
+			}
+		}
+	});
+
+	// Central differences over the baked distances, one-sided at the edges of the field
+	pool->ParallelFor(resolution, 1, [&](int begin, int end) {
+		for (int z = begin; z < end; ++z) {
+			for (int y = 0; y < resolution; ++y) {
+				for (int x = 0; x < resolution; ++x) {
+					int x0 = (int)fmax(x - 1, 0), x1 = (int)fmin(x + 1, resolution - 1);
+					int y0 = (int)fmax(y - 1, 0), y1 = (int)fmin(y + 1, resolution - 1);
+					int z0 = (int)fmax(z - 1, 0), z1 = (int)fmin(z + 1, resolution - 1);
+
+					Vector3 gradient(
+						samples[x1 + y * resolution + z * slice].distance - samples[x0 + y * resolution + z * slice].distance,
+						samples[x + y1 * resolution + z * slice].distance - samples[x + y0 * resolution + z * slice].distance,
+						samples[x + y * resolution + z1 * slice].distance - samples[x + y * resolution + z0 * slice].distance);
+
+					samples[x + y * resolution + z * slice].gradient = gradient.Normalised();
+				}
+			}
+		}
+	});
+
+	if (!cacheFile.empty()) {
+		SaveCache(cacheFile, key);
+	}
+}
+
+bool ObstacleField::Lookup(const Vector3& position, float& distance, Vector3& gradient) const {
+	if (samples.empty()) {
+		return false;
+	}
+	float limit = resolution - 1.001f;
+	float fx = Maths::Clamp((position.x + maxBound) * spacingReciprocal, 0.0f, limit);
+	float fy = Maths::Clamp((position.y + maxBound) * spacingReciprocal, 0.0f, limit);
+	float fz = Maths::Clamp((position.z + maxBound) * spacingReciprocal, 0.0f, limit);
+
+	int x = (int)fx, y = (int)fy, z = (int)fz;
+	float tx = fx - x, ty = fy - y, tz = fz - z;
+
+	int slice = resolution * resolution;
+	const FieldSample* s = &samples[x + y * resolution + z * slice];
+
+	auto Lerp = [](const FieldSample& a, const FieldSample& b, float t) -> FieldSample {
+		return { a.gradient + (b.gradient - a.gradient) * t, a.distance + (b.distance - a.distance) * t };
+	};
+
+	FieldSample c00 = Lerp(s[0], s[1], tx);
+	FieldSample c10 = Lerp(s[resolution], s[resolution + 1], tx);
+	FieldSample c01 = Lerp(s[slice], s[slice + 1], tx);
+	FieldSample c11 = Lerp(s[slice + resolution], s[slice + resolution + 1], tx);
+
+	FieldSample result = Lerp(Lerp(c00, c10, ty), Lerp(c01, c11, ty), tz);
+
+	distance = result.distance;
+	gradient = result.gradient;
+	return true;
+}
+
+void ObstacleField::DebugDraw() const {
+	for (const Shape& s : shapes) {
+		Vector3 c = s.center;
+		Vector3 h = s.halfSize;
+		Vector4 colour = Debug::GetLineColour();
+
+		Debug::DrawLine(c + Vector3(h.x, h.y, h.z), c + Vector3(h.x, h.y, -h.z), colour);
+		Debug::DrawLine(c + Vector3(h.x, h.y, -h.z), c + Vector3(-h.x, h.y, -h.z), colour);
+		Debug::DrawLine(c + Vector3(-h.x, h.y, -h.z), c + Vector3(-h.x, h.y, h.z), colour);
+		Debug::DrawLine(c + Vector3(-h.x, h.y, h.z), c + Vector3(h.x, h.y, h.z), colour);
+
+		Debug::DrawLine(c + Vector3(h.x, -h.y, h.z), c + Vector3(h.x, -h.y, -h.z), colour);
+		Debug::DrawLine(c + Vector3(h.x, -h.y, -h.z), c + Vector3(-h.x, -h.y, -h.z), colour);
+		Debug::DrawLine(c + Vector3(-h.x, -h.y, -h.z), c + Vector3(-h.x, -h.y, h.z), colour);
+		Debug::DrawLine(c + Vector3(-h.x, -h.y, h.z), c + Vector3(h.x, -h.y, h.z), colour);
+
+		Debug::DrawLine(c + Vector3(h.x, -h.y, h.z), c + Vector3(h.x, h.y, h.z), colour);
+		Debug::DrawLine(c + Vector3(h.x, -h.y, -h.z), c + Vector3(h.x, h.y, -h.z), colour);
+		Debug::DrawLine(c + Vector3(-h.x, -h.y, -h.z), c + Vector3(-h.x, h.y, -h.z), colour);
+		Debug::DrawLine(c + Vector3(-h.x, -h.y, h.z), c + Vector3(-h.x, h.y, h.z), colour);
+	}
+}
+
+float ObstacleField::Distance(const Vector3& p) const {
+	float distance = FLT_MAX;
+
+	for (const Shape& s : shapes) {
+		if (s.type == ShapeType::Box) {
+			distance = fmin(distance, BoxDistance(p, s.center, s.halfSize));
+		}
+		else if (s.type == ShapeType::Sphere) {
+			distance = fmin(distance, (p - s.center).Length() - s.radius);
+		}
+		// The bounding box is a lower bound on the distance to the mesh, so skip meshes that can't be closer
+		else if (BoxDistance(p, s.center, s.halfSize) < distance) {
+			distance = fmin(distance, MeshDistance(s, p));
+		}
+	}
+	return distance;
+}
+
+// Unsigned distance to the closest triangle, signed by the pseudonormal of the feature the closest point lies on
+float ObstacleField::MeshDistance(const Shape& mesh, const Vector3& p) const {
+	float closestSquared = FLT_MAX;
+	float sign = 1.0f;
+
+	for (int i = mesh.firstTriangle; i < mesh.firstTriangle + mesh.triangleCount; ++i) {
+		const Triangle& t = triangles[i];
+		int feature;
+		Vector3 offset = p - ClosestPointOnTriangle(p, t.a, t.b, t.c, feature);
+		float distanceSquared = offset.LengthSquared();
+
+		if (distanceSquared < closestSquared) {
+			closestSquared = distanceSquared;
+			sign = Vector3::Dot(offset, t.pseudonormals[feature]) < 0 ? -1.0f : 1.0f;
+		}
+	}
+	return sqrt(closestSquared) * sign;
+}
+
+uint64_t ObstacleField::CacheKey() const {
+	uint64_t hash = 14695981039346656037ull;
+	hash = HashBytes(hash, &resolution, sizeof(resolution));
+	hash = HashBytes(hash, &maxBound, sizeof(maxBound));
+	for (const Shape& s : shapes) {
+		hash = HashBytes(hash, &s.type, sizeof(s.type));
+		hash = HashBytes(hash, s.center.array, sizeof(s.center.array));
+		hash = HashBytes(hash, s.halfSize.array, sizeof(s.halfSize.array));
+		hash = HashBytes(hash, &s.radius, sizeof(s.radius));
+	}
+	for (const Triangle& t : triangles) {
+		hash = HashBytes(hash, &t, sizeof(Triangle));
+	}
+	return hash;
+}
+
+bool ObstacleField::LoadCache(const std::string& cacheFile, uint64_t key) {
+	std::ifstream file(Assets::DATADIR + cacheFile, std::ios::binary);
+	if (!file) {
+		return false;
+	}
+	char magic[4];
+	uint32_t version;
+	uint64_t fileKey;
+
+	file.read(magic, sizeof(magic));
+	file.read((char*)&version, sizeof(version));
+	file.read((char*)&fileKey, sizeof(fileKey));
+
+	if (!file || memcmp(magic, cacheMagic, sizeof(magic)) != 0 || version != cacheVersion || fileKey != key) {
+		return false;
+	}
+	samples.resize(resolution * resolution * resolution);
+	file.read((char*)samples.data(), samples.size() * sizeof(FieldSample));
+
+	if (!file) {
+		samples.clear();
+		return false;
+	}
+	return true;
+}
+
+void ObstacleField::SaveCache(const std::string& cacheFile, uint64_t key) const {
+	std::ofstream file(Assets::DATADIR + cacheFile, std::ios::binary);
+	if (!file) {
+		std::cout << "Unable to write obstacle cache " << cacheFile << std::endl;
+		return;
+	}
+	file.write(cacheMagic, sizeof(cacheMagic));
+	file.write((const char*)&cacheVersion, sizeof(cacheVersion));
+	file.write((const char*)&key, sizeof(key));
+	file.write((const char*)samples.data(), samples.size() * sizeof(FieldSample));
+}
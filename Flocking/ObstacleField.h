@@ -0,0 +1,91 @@
+#pragma once
+
+#include "../Common/Vector3.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace NCL {
+	using namespace NCL::Maths;
+	class MeshGeometry;
+	class ThreadPool;
+
+	// Static obstacles are baked once into a signed distance field over the flock bounds.
+	// Agents then pay a single trilinear lookup per step, however many obstacles there are.
+	class ObstacleField {
+	public:
+		// Matches a vec4 in the compute shaders: xyz = gradient, w = signed distance
+		struct FieldSample {
+			Vector3 gradient;
+			float distance;
+		};
+
+		ObstacleField();
+		~ObstacleField() {}
+
+		bool LoadFromFile(const std::string& filename);
+
+		void AddBox(const Vector3& center, const Vector3& halfSize);
+		void AddSphere(const Vector3& center, float radius);
+		void AddMesh(const MeshGeometry& mesh, const Vector3& position, float scale);
+
+		// Loads the field from the cache file when it matches the current obstacles, otherwise bakes and rewrites it
+		void Bake(float maxBound, ThreadPool* pool, const std::string& cacheFile = "");
+
+		bool Lookup(const Vector3& position, float& distance, Vector3& gradient) const;
+
+		bool IsEmpty() const {
+			return samples.empty();
+		}
+
+		int GetResolution() const {
+			return resolution;
+		}
+
+		const std::vector<FieldSample>& GetSamples() const {
+			return samples;
+		}
+
+		void DebugDraw() const;
+
+	protected:
+		enum class ShapeType {
+			Box,
+			Sphere,
+			Mesh
+		};
+
+		struct Shape {
+			ShapeType type;
+			Vector3 center;
+			Vector3 halfSize;
+			float radius;
+			int firstTriangle;
+			int triangleCount;
+		};
+
+		struct Triangle {
+			Vector3 a;
+			Vector3 b;
+			Vector3 c;
+			// Vertices a, b, c, then edges ab, bc, ca, then the face
+			Vector3 pseudonormals[7];
+		};
+
+		float Distance(const Vector3& p) const;
+		float MeshDistance(const Shape& mesh, const Vector3& p) const;
+		void BuildPseudonormals(const Shape& mesh);
+
+		uint64_t CacheKey() const;
+		bool LoadCache(const std::string& cacheFile, uint64_t key);
+		void SaveCache(const std::string& cacheFile, uint64_t key) const;
+
+		std::vector<Shape> shapes;
+		std::vector<Triangle> triangles;
+		std::vector<FieldSample> samples;
+
+		int resolution;
+		float maxBound;
+		float spacingReciprocal;
+	};
+}
@@ -1,53 +1,153 @@
 #include "Octree.h"
+#include <array>
 
-void NCL::OctreeNode::Insert(Agent* object, int depthLeft, int maxSize) {
-	if (!AABB::PointContained(object->position, position, size)) {
+namespace {
+	// Agents are counted and scattered in fixed chunks so the partition never depends on the thread count
+	const int partitionChunkSize = 4096;
+	// Children with fewer agents than this are built inline rather than as a separate task
+	const int taskCutoff = 2048;
+
+	inline int ChunkEnd(int chunk, int count) {
+		int end = (chunk + 1) * partitionChunkSize;
+		return end < count ? end : count;
+	}
+}
+
+void NCL::Octree::Build(const Agent* agents, int count, ThreadPool* pool) {
+	Clear();
+	this->agents = agents;
+	if (arena) {
+		order = arena->New<int>(count);
+		scratch = arena->New<int>(count);
+	}
+	else if (count != orderCount) {
+		delete[] order;
+		delete[] scratch;
+		order = new int[count];
+		scratch = new int[count];
+	}
+	orderCount = count;
+
+	for (int i = 0; i < count; ++i) {
+		order[i] = i;
+	}
+
+	root.first = 0;
+	root.count = count;
+
+	ThreadPool::TaskGroup group;
+	BuildNode(root, maxDepth, pool, group);
+	pool->Wait(group);
+}
+
+void NCL::Octree::BuildNode(OctreeNode& node, int depthLeft, ThreadPool* pool, ThreadPool::TaskGroup& group) {
+	if (node.count <= maxSize || depthLeft <= 0) {
 		return;
 	}
-	if (children) {
-		for (int i = 0; i < 8; ++i) {
-			children[i].Insert(object, depthLeft - 1, maxSize);
+
+	int octantCounts[8];
+	Partition(node, octantCounts, pool);
+
+	node.Split(arena);
+	int childFirst = node.first;
+	for (int i = 0; i < 8; ++i) {
+		OctreeNode& child = node.children[i];
+		child.first = childFirst;
+		child.count = octantCounts[i];
+		childFirst += octantCounts[i];
+
+		if (child.count > taskCutoff) {
+			pool->Run(group, [this, &child, depthLeft, pool, &group]() {
+				BuildNode(child, depthLeft - 1, pool, group);
+			});
+		}
+		else {
+			BuildNode(child, depthLeft - 1, pool, group);
 		}
 	}
+}
+
+void NCL::Octree::Partition(OctreeNode& node, int octantCounts[8], ThreadPool* pool) {
+	int chunkCount = (node.count + partitionChunkSize - 1) / partitionChunkSize;
+
+	std::vector<std::array<int, 8>> heapOffsets;
+	std::array<int, 8>* chunkOffsets;
+	if (arena) {
+		chunkOffsets = arena->New<std::array<int, 8>>(chunkCount);
+	}
 	else {
-		contents.push_back(object);
-		if (contents.size() > maxSize && depthLeft > 0) {
-			if (!children) {
-				Split();
-				for (Agent* a : contents) {
-					for (int j = 0; j < 8; ++j) {
-						children[j].Insert(a, depthLeft - 1, maxSize);
-					}
-				}
-				contents.clear();
+		heapOffsets.resize(chunkCount);
+		chunkOffsets = heapOffsets.data();
+	}
+
+	pool->ParallelFor(chunkCount, 1, [&](int begin, int end) {
+		for (int c = begin; c < end; ++c) {
+			std::array<int, 8>& histogram = chunkOffsets[c];
+			histogram.fill(0);
+
+			int chunkEnd = node.first + ChunkEnd(c, node.count);
+			for (int i = node.first + c * partitionChunkSize; i < chunkEnd; ++i) {
+				histogram[node.Octant(agents[order[i]].position)]++;
 			}
 		}
+	});
+
+	// Exclusive prefix sum, octant major, so each chunk scatters into its own stable range
+	int offset = node.first;
+	for (int o = 0; o < 8; ++o) {
+		int octantStart = offset;
+		for (int c = 0; c < chunkCount; ++c) {
+			int agentsInChunk = chunkOffsets[c][o];
+			chunkOffsets[c][o] = offset;
+			offset += agentsInChunk;
+		}
+		octantCounts[o] = offset - octantStart;
 	}
+
+	pool->ParallelFor(chunkCount, 1, [&](int begin, int end) {
+		for (int c = begin; c < end; ++c) {
+			std::array<int, 8>& cursor = chunkOffsets[c];
+
+			int chunkEnd = node.first + ChunkEnd(c, node.count);
+			for (int i = node.first + c * partitionChunkSize; i < chunkEnd; ++i) {
+				scratch[cursor[node.Octant(agents[order[i]].position)]++] = order[i];
+			}
+		}
+	});
+
+	pool->ParallelFor(chunkCount, 1, [&](int begin, int end) {
+		int copyBegin = node.first + begin * partitionChunkSize;
+		int copyEnd = node.first + ChunkEnd(end - 1, node.count);
+		std::copy(scratch + copyBegin, scratch + copyEnd, order + copyBegin);
+	});
 }
 
-void NCL::OctreeNode::GetNeighbours(Agent* object, float radius, std::vector<Agent*>& collidingNodes, bool useSphereOverlap) {
+void NCL::OctreeNode::GetNeighbours(const Vector3& point, float radius, const int* order, std::vector<int>& collidingNodes, bool useSphereOverlap, int maxCount) {
 	bool overlap = useSphereOverlap ?
-		AABB::SphereInsersection(size, position, object->position, radius) :
-		AABB::Intersection(AABB::GetHalfSizeFromRadius(radius), object->position, size, position);
+		AABB::SphereInsersection(size, position, point, radius) :
+		AABB::Intersection(AABB::GetHalfSizeFromRadius(radius), point, size, position);
 
 	if (!overlap) {
 		return;
 	}
 	if (children) {
 		for (int i = 0; i < 8; ++i) {
-			children[i].GetNeighbours(object, radius, collidingNodes);
+			children[i].GetNeighbours(point, radius, order, collidingNodes, useSphereOverlap, maxCount);
 		}
 	}
 	else {
-		for (Agent* a : contents) {
-			collidingNodes.push_back(a);
+		int room = maxCount - (int)collidingNodes.size();
+		int taken = count < room ? count : room;
+		if (taken > 0) {
+			collidingNodes.insert(collidingNodes.end(), order + first, order + first + taken);
 		}
 	}
 }
 
-void NCL::OctreeNode::Split() {
+void NCL::OctreeNode::Split(FrameArena* arena) {
 	Vector3 halfSize = size * 0.5f;
-	children = new OctreeNode[8];
+	arenaChildren = arena != nullptr;
+	children = arenaChildren ? arena->New<OctreeNode>(8) : new OctreeNode[8];
 	children[0] = OctreeNode(position + Vector3(-halfSize.x, halfSize.y, halfSize.z), halfSize);
 	children[1] = OctreeNode(position + Vector3(halfSize.x, halfSize.y, halfSize.z), halfSize);
 	children[2] = OctreeNode(position + Vector3(-halfSize.x, -halfSize.y, halfSize.z), halfSize);
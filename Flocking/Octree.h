@@ -2,7 +2,10 @@
 #include "Debug.h"
 #include "AABB.h"
 #include "Agent.h"
-#include <list>
+#include "FrameArena.h"
+#include "ThreadPool.h"
+#include <climits>
+#include <vector>
 
 namespace NCL {
 	using namespace NCL::Maths;
@@ -12,31 +15,49 @@ namespace NCL {
 	class OctreeNode {
 	protected:
 		friend class Octree;
+		friend class FrameArena;
 
-		OctreeNode() {}
+		OctreeNode() {
+			children = nullptr;
+			arenaChildren = false;
+			first = 0;
+			count = 0;
+		}
 
 		OctreeNode(Vector3 pos, Vector3 size) {
 			children = nullptr;
+			arenaChildren = false;
+			first = 0;
+			count = 0;
 			this->position = pos;
 			this->size = size;
 		}
 
 		~OctreeNode() {
-			delete[] children;
+			if (!arenaChildren) {
+				delete[] children;
+			}
 		}
 
-		void Insert(Agent* object, int depthLeft, int maxSize);
-		void GetNeighbours(Agent* object, float radius, std::vector<Agent*>& collidingNodes, bool useSphereOverlap = false);
-		void Split();
+		void GetNeighbours(const Vector3& point, float radius, const int* order, std::vector<int>& collidingNodes, bool useSphereOverlap = false, int maxCount = INT_MAX);
+		void Split(FrameArena* arena);
 		void DebugDraw();
 
+		// Matches the child order used by Split
+		int Octant(const Vector3& point) const {
+			return (point.x >= position.x ? 1 : 0) + (point.y < position.y ? 2 : 0) + (point.z < position.z ? 4 : 0);
+		}
+
 	protected:
-		std::list<Agent*> contents;
+		// Leaves own the span [first, first + count) of the octree's agent order
+		int first;
+		int count;
 
 		Vector3 position;
 		Vector3 size;
 
 		OctreeNode* children;
+		bool arenaChildren;
 	};
 }
 
@@ -45,20 +66,63 @@ namespace NCL {
 	class Octree
 	{
 	public:
-		Octree(Vector3 size, int maxDepth = 6, int maxSize = 5) {
+		// With an arena, nodes and agent order come from it and stay valid until the arena is reset
+		Octree(Vector3 size, int maxDepth = 6, int maxSize = 5, FrameArena* arena = nullptr) {
 			root = OctreeNode(Vector3(), size);
+			agents = nullptr;
+			this->arena = arena;
 			this->maxDepth = maxDepth;
 			this->maxSize = maxSize;
+			order = nullptr;
+			scratch = nullptr;
+			orderCount = 0;
 		}
 		~Octree() {
+			if (!arena) {
+				delete[] order;
+				delete[] scratch;
+			}
 		}
 
-		void Insert(Agent* object) {
-			root.Insert(object, maxDepth, maxSize);
+		// Sorts the agents into octants top down. Nodes above a size cutoff partition their agents with a
+		// parallel counting pass and hand their children to the pool. Chunking never depends on the thread
+		// count, so the resulting layout is the same however many threads take part.
+		void Build(const Agent* agents, int count, ThreadPool* pool);
+
+		// Drops the nodes of the last build. Arena nodes are left for the arena to reclaim.
+		void Clear() {
+			if (!root.arenaChildren) {
+				delete[] root.children;
+			}
+			root.children = nullptr;
+			root.arenaChildren = false;
+			root.first = 0;
+			root.count = 0;
+
+			if (arena) {
+				order = nullptr;
+				scratch = nullptr;
+				orderCount = 0;
+			}
 		}
 
+		// Appends the indices of the agents in every leaf the query overlaps, stopping once candidates holds maxCount
+		void GetNeighbours(const Vector3& position, float radius, std::vector<int>& candidates, bool useSphereOverlap = false, int maxCount = INT_MAX) {
+			root.GetNeighbours(position, radius, order, candidates, useSphereOverlap, maxCount);
+		}
+
+		// Pointer based adapter over the index query
 		void GetNeighbours(Agent* object, float radius, std::vector<Agent*>& collidingNodes, bool useSphereOverlap = false) {
-			root.GetNeighbours(object, radius, collidingNodes, useSphereOverlap);
+			std::vector<int> candidates;
+			root.GetNeighbours(object->position, radius, order, candidates, useSphereOverlap);
+			for (int index : candidates) {
+				collidingNodes.push_back(const_cast<Agent*>(&agents[index]));
+			}
+		}
+
+		// Agent indices in leaf order, used to check that builds are deterministic
+		std::vector<int> GetOrder() const {
+			return std::vector<int>(order, order + orderCount);
 		}
 
 		void DebugDraw() {
@@ -66,8 +130,18 @@ namespace NCL {
 		}
 
 	protected:
+		void BuildNode(OctreeNode& node, int depthLeft, ThreadPool* pool, ThreadPool::TaskGroup& group);
+		void Partition(OctreeNode& node, int octantCounts[8], ThreadPool* pool);
+
 		OctreeNode root;
 		int maxDepth;
 		int maxSize;
+
+		const Agent* agents;
+		FrameArena* arena;
+
+		int* order;
+		int* scratch;
+		int orderCount;
 	};
 }
@@ -0,0 +1,142 @@
+#include "RadixSort.h"
+
+using namespace NCL;
+
+namespace {
+	// Chunks never depend on the thread count, so every pool produces the same order
+	const int chunkSize = 16384;
+	const int digitBits = 8;
+	const int digitCount = 1 << digitBits;
+}
+
+RadixSort::RadixSort() {
+	nearlySortedFraction = 0.01f;
+}
+
+int RadixSort::Sort(std::vector<uint32_t>& keys, std::vector<int>& values, ThreadPool* pool) {
+	int count = (int)keys.size();
+	if (count < 2) {
+		return 0;
+	}
+	int chunkCount = (count + chunkSize - 1) / chunkSize;
+
+	// One pass finds how disordered the keys are and how many digits they actually use
+	std::vector<int> chunkDescents(chunkCount);
+	std::vector<uint32_t> chunkMax(chunkCount);
+
+	pool->ParallelFor(chunkCount, 1, [&](int begin, int end) {
+		for (int c = begin; c < end; ++c) {
+			int first = c * chunkSize;
+			int last = first + chunkSize < count ? first + chunkSize : count;
+			int descents = 0;
+			uint32_t highest = 0;
+
+			for (int i = first; i < last; ++i) {
+				descents += (i > 0 && keys[i] < keys[i - 1]) ? 1 : 0;
+				highest = keys[i] > highest ? keys[i] : highest;
+			}
+			chunkDescents[c] = descents;
+			chunkMax[c] = highest;
+		}
+	});
+
+	long long descents = 0;
+	uint32_t maxKey = 0;
+	for (int c = 0; c < chunkCount; ++c) {
+		descents += chunkDescents[c];
+		maxKey = chunkMax[c] > maxKey ? chunkMax[c] : maxKey;
+	}
+
+	if (descents == 0) {
+		return 0;
+	}
+	// A few agents swapping places only needs a few short moves, but a budget guards against one key travelling far
+	if (descents <= (long long)(count * nearlySortedFraction) && InsertionSort(keys, values, (long long)count * 8)) {
+		return 0;
+	}
+
+	keyScratch.resize(count);
+	valueScratch.resize(count);
+	chunkHistograms.resize(chunkCount);
+
+	int passes = 0;
+	for (int shift = 0; shift < 32 && (maxKey >> shift) != 0; shift += digitBits) {
+		pool->ParallelFor(chunkCount, 1, [&](int begin, int end) {
+			for (int c = begin; c < end; ++c) {
+				std::array<int, 256>& histogram = chunkHistograms[c];
+				histogram.fill(0);
+
+				int last = (c + 1) * chunkSize < count ? (c + 1) * chunkSize : count;
+				for (int i = c * chunkSize; i < last; ++i) {
+					histogram[(keys[i] >> shift) & (digitCount - 1)]++;
+				}
+			}
+		});
+
+		// Digit major, chunk minor exclusive scan, so each chunk scatters stably into its own ranges
+		bool singleDigit = false;
+		int offset = 0;
+		for (int d = 0; d < digitCount; ++d) {
+			int digitStart = offset;
+			for (int c = 0; c < chunkCount; ++c) {
+				int inChunk = chunkHistograms[c][d];
+				chunkHistograms[c][d] = offset;
+				offset += inChunk;
+			}
+			if (offset - digitStart == count) {
+				singleDigit = true;
+				break;
+			}
+		}
+		if (singleDigit) {
+			continue;
+		}
+
+		pool->ParallelFor(chunkCount, 1, [&](int begin, int end) {
+			for (int c = begin; c < end; ++c) {
+				std::array<int, 256>& cursor = chunkHistograms[c];
+
+				int last = (c + 1) * chunkSize < count ? (c + 1) * chunkSize : count;
+				for (int i = c * chunkSize; i < last; ++i) {
+					int destination = cursor[(keys[i] >> shift) & (digitCount - 1)]++;
+					keyScratch[destination] = keys[i];
+					valueScratch[destination] = values[i];
+				}
+			}
+		});
+
+		keys.swap(keyScratch);
+		values.swap(valueScratch);
+		passes++;
+	}
+	return passes;
+}
+
+bool RadixSort::InsertionSort(std::vector<uint32_t>& keys, std::vector<int>& values, long long maxMoves) {
+	int count = (int)keys.size();
+	long long moves = 0;
+
+	for (int i = 1; i < count; ++i) {
+		uint32_t key = keys[i];
+		if (key >= keys[i - 1]) {
+			continue;
+		}
+		int value = values[i];
+		int j = i;
+
+		while (j > 0 && keys[j - 1] > key) {
+			keys[j] = keys[j - 1];
+			values[j] = values[j - 1];
+			--j;
+		}
+		keys[j] = key;
+		values[j] = value;
+
+		// Giving up part way still leaves a permutation of the input, which the radix passes then sort
+		moves += i - j;
+		if (moves > maxMoves) {
+			return false;
+		}
+	}
+	return true;
+}
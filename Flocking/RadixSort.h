@@ -0,0 +1,36 @@
+#pragma once
+
+#include "ThreadPool.h"
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace NCL {
+	// Parallel LSD radix sort of 32 bit keys, carrying a value (normally an agent index) with each key.
+	// Callers keep their arrays in last frame's order and refresh the keys in place, so most frames the
+	// input is already sorted or close to it: a sorted input returns straight away, a nearly sorted one
+	// is finished with a bounded insertion sort, and only real disorder pays for the radix passes.
+	// Passes whose digit is the same for every key are skipped.
+	class RadixSort {
+	public:
+		RadixSort();
+		~RadixSort() {}
+
+		// Stable, so equal keys keep their previous order. Returns the number of radix passes that ran.
+		int Sort(std::vector<uint32_t>& keys, std::vector<int>& values, ThreadPool* pool);
+
+		// At most this fraction of neighbouring keys may be out of order for the insertion sort to be tried
+		void SetNearlySortedFraction(float fraction) {
+			nearlySortedFraction = fraction;
+		}
+
+	protected:
+		bool InsertionSort(std::vector<uint32_t>& keys, std::vector<int>& values, long long maxMoves);
+
+		float nearlySortedFraction;
+
+		std::vector<uint32_t> keyScratch;
+		std::vector<int> valueScratch;
+		std::vector<std::array<int, 256>> chunkHistograms;
+	};
+}
@@ -19,6 +19,61 @@ NCL::Simulation::Settings NCL::SettingsLoader::LoadSettingsFromFile(std::string
 	settings.avoidanceWeight = 1.0f;
 	settings.modelScale = 50.0f;
 
+	settings.obstacleFile = "";
+	settings.obstacleWeight = 1.0f;
+	settings.obstacleRange = 5.0f;
+
+	settings.boundaryMode = Simulation::BoundaryMode::Wrap;
+	settings.containMargin = 10.0f;
+
+	settings.alignmentFOV = 360.0f;
+	settings.separationFOV = 360.0f;
+	settings.cohesionFOV = 360.0f;
+
+	settings.pipelineDepth = 1;
+
+	settings.asyncSimulation = false;
+	settings.simulationRate = 60.0f;
+
+	settings.numaAware = false;
+
+	settings.amortisedBudget = 0.0f;
+
+	settings.reorderInterval = 0;
+	settings.reorderDisorder = 0.1f;
+	settings.candidateCap = 0;
+
+	settings.alignmentInterval = 1;
+	settings.separationInterval = 1;
+	settings.cohesionInterval = 1;
+
+	settings.lodNearDistance = 0.0f;
+	settings.lodFarDistance = 0.0f;
+	settings.lodHysteresis = 0.1f;
+	settings.lodMidInterval = 2;
+	settings.lodFarInterval = 4;
+	settings.lodMidCap = 32;
+	settings.lodFarCap = 16;
+
+	settings.fixedStepRate = 0.0f;
+	settings.maxStepsPerFrame = 4;
+
+	settings.domainCount = 0;
+	settings.domainRank = 0;
+	settings.domainSocketPath = "flock-domain";
+
+	settings.balanceThreshold = 0.1f;
+	settings.balanceInterval = 30;
+
+	settings.sharedStateName = "";
+
+	settings.checkpointFile = "flock.checkpoint";
+
+	settings.trajectoryFile = "";
+	settings.trajectoryInterval = 1;
+	settings.trajectoryBits = 16;
+	settings.trajectoryBlockFrames = 16;
+
 	std::string contents;
 
 	if (Assets::ReadTextFile(Assets::DATADIR + filename, contents)) {
@@ -64,6 +119,138 @@ NCL::Simulation::Settings NCL::SettingsLoader::LoadSettingsFromFile(std::string
 
 		std::getline(iss, data);
 		settings.modelScale = std::stof(data);
+
+		// Optional settings follow the fixed block as "name value" lines
+		while (std::getline(iss, data)) {
+			std::istringstream line(data);
+			std::string name;
+
+			if (!(line >> name)) {
+				continue;
+			}
+			if (name == "obstacleFile") {
+				line >> settings.obstacleFile;
+			}
+			else if (name == "obstacleWeight") {
+				line >> settings.obstacleWeight;
+			}
+			else if (name == "obstacleRange") {
+				line >> settings.obstacleRange;
+			}
+			else if (name == "boundaryMode") {
+				int mode = 0;
+				line >> mode;
+				settings.boundaryMode = mode == 1 ? Simulation::BoundaryMode::Contain : Simulation::BoundaryMode::Wrap;
+			}
+			else if (name == "containMargin") {
+				line >> settings.containMargin;
+			}
+			else if (name == "alignmentFOV") {
+				line >> settings.alignmentFOV;
+			}
+			else if (name == "separationFOV") {
+				line >> settings.separationFOV;
+			}
+			else if (name == "cohesionFOV") {
+				line >> settings.cohesionFOV;
+			}
+			else if (name == "pipelineDepth") {
+				line >> settings.pipelineDepth;
+			}
+			else if (name == "asyncSimulation") {
+				line >> settings.asyncSimulation;
+			}
+			else if (name == "simulationRate") {
+				line >> settings.simulationRate;
+			}
+			else if (name == "numaAware") {
+				line >> settings.numaAware;
+			}
+			else if (name == "amortisedBudget") {
+				line >> settings.amortisedBudget;
+			}
+			else if (name == "reorderInterval") {
+				line >> settings.reorderInterval;
+			}
+			else if (name == "reorderDisorder") {
+				line >> settings.reorderDisorder;
+			}
+			else if (name == "candidateCap") {
+				line >> settings.candidateCap;
+			}
+			else if (name == "alignmentInterval") {
+				line >> settings.alignmentInterval;
+			}
+			else if (name == "separationInterval") {
+				line >> settings.separationInterval;
+			}
+			else if (name == "cohesionInterval") {
+				line >> settings.cohesionInterval;
+			}
+			else if (name == "lodNearDistance") {
+				line >> settings.lodNearDistance;
+			}
+			else if (name == "lodFarDistance") {
+				line >> settings.lodFarDistance;
+			}
+			else if (name == "lodHysteresis") {
+				line >> settings.lodHysteresis;
+			}
+			else if (name == "lodMidInterval") {
+				line >> settings.lodMidInterval;
+			}
+			else if (name == "lodFarInterval") {
+				line >> settings.lodFarInterval;
+			}
+			else if (name == "lodMidCap") {
+				line >> settings.lodMidCap;
+			}
+			else if (name == "lodFarCap") {
+				line >> settings.lodFarCap;
+			}
+			else if (name == "fixedStepRate") {
+				line >> settings.fixedStepRate;
+			}
+			else if (name == "maxStepsPerFrame") {
+				line >> settings.maxStepsPerFrame;
+			}
+			else if (name == "domainCount") {
+				line >> settings.domainCount;
+			}
+			else if (name == "domainRank") {
+				line >> settings.domainRank;
+			}
+			else if (name == "domainSocketPath") {
+				line >> settings.domainSocketPath;
+			}
+			else if (name == "balanceThreshold") {
+				line >> settings.balanceThreshold;
+			}
+			else if (name == "balanceInterval") {
+				line >> settings.balanceInterval;
+			}
+			else if (name == "sharedStateName") {
+				line >> settings.sharedStateName;
+			}
+			else if (name == "checkpointFile") {
+				line >> settings.checkpointFile;
+			}
+			else if (name == "trajectoryFile") {
+				line >> settings.trajectoryFile;
+			}
+			else if (name == "trajectoryInterval") {
+				line >> settings.trajectoryInterval;
+			}
+			else if (name == "trajectoryBits") {
+				line >> settings.trajectoryBits;
+			}
+			else if (name == "trajectoryBlockFrames") {
+				line >> settings.trajectoryBlockFrames;
+			}
+			else {
+				std::cout << "Unknown setting: " << name << std::endl;
+			}
+		}
 	}
 	else {
 		std::cout << "Error reading settings file. Using default settings." << std::endl;
@@ -83,6 +270,34 @@ NCL::Simulation::Settings NCL::SettingsLoader::LoadSettingsFromFile(std::string
 	std::cout << "Cohesion Weight: "	<< settings.cohesionWeight << std::endl;
 	std::cout << "Avoidance Weight: "	<< settings.avoidanceWeight << std::endl;
 	std::cout << "Model Scale: "		<< settings.modelScale << std::endl;
+	std::cout << "Obstacle File: "		<< settings.obstacleFile << std::endl;
+	std::cout << "Obstacle Weight: "	<< settings.obstacleWeight << std::endl;
+	std::cout << "Obstacle Range: "		<< settings.obstacleRange << std::endl;
+	std::cout << "Boundary Mode: "		<< (settings.boundaryMode == Simulation::BoundaryMode::Contain ? "Contain" : "Wrap") << std::endl;
+	std::cout << "Contain Margin: "		<< settings.containMargin << std::endl;
+	std::cout << "Alignment FOV: "		<< settings.alignmentFOV << std::endl;
+	std::cout << "Separation FOV: "		<< settings.separationFOV << std::endl;
+	std::cout << "Cohesion FOV: "		<< settings.cohesionFOV << std::endl;
+	std::cout << "Pipeline Depth: "		<< settings.pipelineDepth << std::endl;
+	std::cout << "Async Simulation: "	<< (settings.asyncSimulation ? "On" : "Off") << std::endl;
+	std::cout << "Simulation Rate: "	<< settings.simulationRate << std::endl;
+	std::cout << "NUMA Aware: "			<< (settings.numaAware ? "On" : "Off") << std::endl;
+	std::cout << "Amortised Budget: "	<< settings.amortisedBudget << std::endl;
+	std::cout << "Reorder Interval: "	<< settings.reorderInterval << std::endl;
+	std::cout << "Reorder Disorder: "	<< settings.reorderDisorder << std::endl;
+	std::cout << "Candidate Cap: "		<< settings.candidateCap << std::endl;
+	std::cout << "Rule Intervals: "		<< settings.alignmentInterval << ", " << settings.separationInterval << ", " << settings.cohesionInterval << std::endl;
+	std::cout << "LOD Distances: "		<< settings.lodNearDistance << ", " << settings.lodFarDistance << " (hysteresis " << settings.lodHysteresis << ")" << std::endl;
+	std::cout << "LOD Intervals: "		<< settings.lodMidInterval << ", " << settings.lodFarInterval << std::endl;
+	std::cout << "LOD Caps: "			<< settings.lodMidCap << ", " << settings.lodFarCap << std::endl;
+	std::cout << "Fixed Step Rate: "	<< settings.fixedStepRate << std::endl;
+	std::cout << "Max Steps Per Frame: " << settings.maxStepsPerFrame << std::endl;
+	std::cout << "Domains: "			<< settings.domainCount << " (rank " << settings.domainRank << ", " << settings.domainSocketPath << ")" << std::endl;
+	std::cout << "Load Balancing: "		<< settings.balanceThreshold << " every " << settings.balanceInterval << " steps" << std::endl;
+	std::cout << "Shared State: "		<< settings.sharedStateName << std::endl;
+	std::cout << "Checkpoint File: "	<< settings.checkpointFile << std::endl;
+	std::cout << "Trajectory File: "	<< settings.trajectoryFile << " (every " << settings.trajectoryInterval << " steps)" << std::endl;
+	std::cout << "Trajectory Coding: "	<< settings.trajectoryBits << " bits, " << settings.trajectoryBlockFrames << " frame blocks" << std::endl;
 
 	return settings;
 }
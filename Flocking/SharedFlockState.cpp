@@ -0,0 +1,200 @@
+#include "SharedFlockState.h"
+#include "Agent.h"
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace NCL;
+
+namespace {
+	const uint32_t stateMagic = 0x464c4b32;
+
+	// Agents start on their own cache line, away from the counters the writer keeps touching
+	const size_t agentsOffset = 256;
+
+#ifndef _WIN32
+	std::string SegmentName(const std::string& name) {
+		return "/" + name;
+	}
+#endif
+}
+
+SharedFlockState::SharedFlockState(const std::string& name, bool owner) {
+	this->name = name;
+	this->owner = owner;
+	header = nullptr;
+	mappedBytes = 0;
+	handle = -1;
+}
+
+SharedFlockState::~SharedFlockState() {
+#ifdef _WIN32
+	if (header) {
+		UnmapViewOfFile(header);
+	}
+	if (handle != -1) {
+		CloseHandle((HANDLE)handle);
+	}
+#else
+	if (header) {
+		munmap(header, mappedBytes);
+	}
+	if (handle != -1) {
+		close((int)handle);
+	}
+	// Viewers that are attached keep their mapping, but nothing new can attach
+	if (owner) {
+		shm_unlink(SegmentName(name).c_str());
+	}
+#endif
+}
+
+SharedFlockState* SharedFlockState::Create(const std::string& name, int numAgents, float maxBound, float modelScale) {
+	static_assert(sizeof(Header) <= agentsOffset, "Shared flock header overlaps the agents");
+
+	SharedFlockState* state = new SharedFlockState(name, true);
+	if (!state->Map(agentsOffset + 2 * numAgents * sizeof(Agent), true)) {
+		std::cout << "Can't create shared flock state " << name << std::endl;
+		delete state;
+		return nullptr;
+	}
+
+	Header* header = state->header;
+	header->magic = 0;
+	header->agentSize = sizeof(Agent);
+	header->numAgents = numAgents;
+	header->maxBound = maxBound;
+	header->modelScale = modelScale;
+	header->newest = 0;
+	header->heartbeat = 0;
+	for (int i = 0; i < 2; ++i) {
+		header->buffers[i].sequence = 0;
+		header->buffers[i].step = 0;
+		header->buffers[i].count = 0;
+	}
+	// Written last, so a viewer attaching mid way doesn't take the segment for a finished one
+	std::atomic_thread_fence(std::memory_order_release);
+	header->magic = stateMagic;
+	return state;
+}
+
+SharedFlockState* SharedFlockState::Open(const std::string& name) {
+	SharedFlockState* state = new SharedFlockState(name, false);
+	if (!state->Map(agentsOffset, false)) {
+		delete state;
+		return nullptr;
+	}
+	Header* header = state->header;
+	if (header->magic != stateMagic || header->agentSize != sizeof(Agent)) {
+		delete state;
+		return nullptr;
+	}
+
+	// Now the agent count is known, the agents can be mapped as well
+	size_t bytes = agentsOffset + 2 * header->numAgents * sizeof(Agent);
+	delete state;
+	state = new SharedFlockState(name, false);
+	if (!state->Map(bytes, false)) {
+		delete state;
+		return nullptr;
+	}
+	return state;
+}
+
+bool SharedFlockState::Map(size_t bytes, bool create) {
+	mappedBytes = bytes;
+#ifdef _WIN32
+	HANDLE mapping = create ?
+		CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)((unsigned long long)bytes >> 32), (DWORD)bytes, name.c_str()) :
+		OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+	if (!mapping) {
+		return false;
+	}
+	handle = (intptr_t)mapping;
+	header = (Header*)MapViewOfFile(mapping, create ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, bytes);
+#else
+	// Truncating a segment viewers still have mapped would fault them on their next read, so a stale one is
+	// unlinked instead, leaving it to them until they detach, and a new one is made in its place
+	if (create) {
+		shm_unlink(SegmentName(name).c_str());
+	}
+	int descriptor = create ?
+		shm_open(SegmentName(name).c_str(), O_CREAT | O_EXCL | O_RDWR, 0644) :
+		shm_open(SegmentName(name).c_str(), O_RDONLY, 0);
+	if (descriptor < 0) {
+		return false;
+	}
+	handle = descriptor;
+	if (create && ftruncate(descriptor, bytes) != 0) {
+		return false;
+	}
+	if (!create) {
+		// A segment still being sized by its creator is too small to map yet
+		struct stat info;
+		if (fstat(descriptor, &info) != 0 || (size_t)info.st_size < bytes) {
+			return false;
+		}
+	}
+	void* memory = mmap(nullptr, bytes, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, descriptor, 0);
+	header = memory == MAP_FAILED ? nullptr : (Header*)memory;
+#endif
+	return header != nullptr;
+}
+
+Agent* SharedFlockState::BufferAgents(int buffer) const {
+	return (Agent*)((char*)header + agentsOffset) + buffer * header->numAgents;
+}
+
+void SharedFlockState::Publish(const Agent* agents, int count, uint64_t step) {
+	count = count < header->numAgents ? count : header->numAgents;
+	int target = header->newest.load(std::memory_order_relaxed) ^ 1;
+	Buffer& buffer = header->buffers[target];
+
+	uint64_t sequence = buffer.sequence.load(std::memory_order_relaxed);
+	buffer.sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	memcpy((void*)BufferAgents(target), agents, count * sizeof(Agent));
+	buffer.step = step;
+	buffer.count = count;
+
+	buffer.sequence.store(sequence + 2, std::memory_order_release);
+	header->newest.store(target, std::memory_order_release);
+}
+
+bool SharedFlockState::Read(uint64_t& step, const std::function<void(const Agent* agents, int count)>& read) const {
+	while (true) {
+		int source = header->newest.load(std::memory_order_acquire);
+		const Buffer& buffer = header->buffers[source];
+
+		uint64_t sequence = buffer.sequence.load(std::memory_order_acquire);
+		if (sequence & 1) {
+			continue;
+		}
+		uint64_t bufferStep = buffer.step;
+		int count = buffer.count;
+		if (sequence == 0 || bufferStep == step) {
+			return false;
+		}
+		// A count torn by the writer is caught below, but mustn't send the read past the buffer first
+		count = count < 0 ? 0 : (count < header->numAgents ? count : header->numAgents);
+
+		read(BufferAgents(source), count);
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (buffer.sequence.load(std::memory_order_relaxed) == sequence) {
+			step = bufferStep;
+			return true;
+		}
+	}
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace NCL {
+	struct Agent;
+
+	// The latest agent state in a named shared memory segment, so a viewer process can attach and detach
+	// while the simulation runs. There are two agent buffers, each behind a sequence counter that is odd
+	// while it is written. The writer fills whichever buffer isn't the newest and never waits on a reader,
+	// and a reader that the writer laps just reads again.
+	class SharedFlockState {
+	public:
+		// Makes a writable segment sized for numAgents, replacing any segment of the same name
+		static SharedFlockState* Create(const std::string& name, int numAgents, float maxBound, float modelScale);
+		// Maps an existing segment read only, or returns nullptr when no simulation has created one
+		static SharedFlockState* Open(const std::string& name);
+		~SharedFlockState();
+
+		void Publish(const Agent* agents, int count, uint64_t step);
+
+		// Called every frame, paused or not, so viewers can tell a simulation that is still running from one
+		// that has gone
+		void Beat() {
+			header->heartbeat.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		uint64_t Heartbeat() const {
+			return header->heartbeat.load(std::memory_order_relaxed);
+		}
+
+		// Runs read on the newest state straight from the shared memory and returns true, or returns false if
+		// nothing newer than step has been published. read may run again if the writer overtook it, and
+		// only the state passed to the last run is whole. step is updated to the state that was read.
+		bool Read(uint64_t& step, const std::function<void(const Agent* agents, int count)>& read) const;
+
+		int NumAgents() const {
+			return header->numAgents;
+		}
+
+		float MaxBound() const {
+			return header->maxBound;
+		}
+
+		float ModelScale() const {
+			return header->modelScale;
+		}
+
+	protected:
+		struct Buffer {
+			std::atomic<uint64_t> sequence;
+			uint64_t step;
+			int32_t count;
+		};
+
+		struct Header {
+			uint32_t magic;
+			uint32_t agentSize;
+			int32_t numAgents;
+			float maxBound;
+			float modelScale;
+			std::atomic<uint32_t> newest;
+			std::atomic<uint64_t> heartbeat;
+			Buffer buffers[2];
+		};
+
+		SharedFlockState(const std::string& name, bool owner);
+
+		bool Map(size_t bytes, bool create);
+		Agent* BufferAgents(int buffer) const;
+
+		std::string name;
+		bool owner;
+
+		Header* header;
+		size_t mappedBytes;
+		// The mapping handle on Windows, the descriptor elsewhere
+		intptr_t handle;
+	};
+}
@@ -1,12 +1,89 @@
 #include "Simulation.h"
 #include "Debug.h"
 #include "Flock.h"
+#include "Agent.h"
+#include "../Common/Quaternion.h"
+#include "../Common/Camera.h"
 #include <random>
 #include <ctime>
 #include <chrono>
 #include <iomanip>
 #include "../Plugins/FreeImage/FreeImage.h"
 
+namespace {
+	// Saving and loading share one list of the settings, so the two can't drift apart
+	template <typename T>
+	void Transfer(NCL::CheckpointWriter& writer, const T& value) {
+		writer.Write(value);
+	}
+	void Transfer(NCL::CheckpointWriter& writer, const std::string& value) {
+		writer.WriteString(value);
+	}
+	template <typename T>
+	void Transfer(NCL::CheckpointReader& reader, T& value) {
+		reader.Read(value);
+	}
+	void Transfer(NCL::CheckpointReader& reader, std::string& value) {
+		reader.ReadString(value);
+	}
+
+	template <typename Stream, typename SettingsType>
+	void TransferSettings(Stream& stream, SettingsType& settings) {
+		Transfer(stream, settings.numAgents);
+		Transfer(stream, settings.alignmentWeight);
+		Transfer(stream, settings.separationWeight);
+		Transfer(stream, settings.cohesionWeight);
+		Transfer(stream, settings.avoidanceWeight);
+		Transfer(stream, settings.alignmentRadius);
+		Transfer(stream, settings.separationRadius);
+		Transfer(stream, settings.cohesionRadius);
+		Transfer(stream, settings.avoidanceRadius);
+		Transfer(stream, settings.maxVelocity);
+		Transfer(stream, settings.maxSteeringAngle);
+		Transfer(stream, settings.maxBound);
+		Transfer(stream, settings.modelScale);
+		Transfer(stream, settings.obstacleFile);
+		Transfer(stream, settings.obstacleWeight);
+		Transfer(stream, settings.obstacleRange);
+		Transfer(stream, settings.boundaryMode);
+		Transfer(stream, settings.containMargin);
+		Transfer(stream, settings.alignmentFOV);
+		Transfer(stream, settings.separationFOV);
+		Transfer(stream, settings.cohesionFOV);
+		Transfer(stream, settings.pipelineDepth);
+		Transfer(stream, settings.asyncSimulation);
+		Transfer(stream, settings.simulationRate);
+		Transfer(stream, settings.numaAware);
+		Transfer(stream, settings.amortisedBudget);
+		Transfer(stream, settings.reorderInterval);
+		Transfer(stream, settings.reorderDisorder);
+		Transfer(stream, settings.candidateCap);
+		Transfer(stream, settings.alignmentInterval);
+		Transfer(stream, settings.separationInterval);
+		Transfer(stream, settings.cohesionInterval);
+		Transfer(stream, settings.lodNearDistance);
+		Transfer(stream, settings.lodFarDistance);
+		Transfer(stream, settings.lodHysteresis);
+		Transfer(stream, settings.lodMidInterval);
+		Transfer(stream, settings.lodFarInterval);
+		Transfer(stream, settings.lodMidCap);
+		Transfer(stream, settings.lodFarCap);
+		Transfer(stream, settings.fixedStepRate);
+		Transfer(stream, settings.maxStepsPerFrame);
+		Transfer(stream, settings.domainCount);
+		Transfer(stream, settings.domainRank);
+		Transfer(stream, settings.domainSocketPath);
+		Transfer(stream, settings.balanceThreshold);
+		Transfer(stream, settings.balanceInterval);
+		Transfer(stream, settings.sharedStateName);
+		Transfer(stream, settings.checkpointFile);
+		Transfer(stream, settings.trajectoryFile);
+		Transfer(stream, settings.trajectoryInterval);
+		Transfer(stream, settings.trajectoryBits);
+		Transfer(stream, settings.trajectoryBlockFrames);
+	}
+}
+
 NCL::Simulation::Simulation(Settings simSettings, FlockingRenderer* renderer) {
 	settings = simSettings;
 	numAgents = settings.numAgents;
@@ -15,18 +92,32 @@ NCL::Simulation::Simulation(Settings simSettings, FlockingRenderer* renderer) {
 	gameTime = 0;
 	dtPrev = 0;
 
+	fixedStep = settings.fixedStepRate > 0 ? 1.0f / settings.fixedStepRate : 0.0f;
+	stepAccumulator = 0;
+
 	this->renderer = renderer;
+	threadPool = new ThreadPool();
 	flock = nullptr;
+	controls = nullptr;
 	bufFlock = -1;
+	bufFlockPrevious = -1;
 
 	showRadii = false;
 	paused = false;
 	drawBox = true;
+
+	mouseRayActive = false;
+	fovRejected = 0;
 }
 
 NCL::Simulation::~Simulation() {
+	glDeleteBuffers(1, &bufFlockPrevious);
 	delete renderer;
+	if (controls != flock) {
+		delete controls;
+	}
 	delete flock;
+	delete threadPool;
 }
 
 void NCL::Simulation::InitFlock() {
@@ -36,51 +127,68 @@ void NCL::Simulation::InitFlock() {
 	float cellDimensionReciprocal = 1 / maxRadius * 0.5f;
 	int cellsPerAxis = (int)settings.maxBound / (maxRadius * 0.5f) + 1;
 
+	if (!settings.obstacleFile.empty() && obstacleField.LoadFromFile(settings.obstacleFile)) {
+		obstacleField.Bake(settings.maxBound, threadPool, settings.obstacleFile + ".sdfcache");
+	}
+
 	for (int i = 0; i < numAgents; ++i) {
-		float x = ((float)rand() / (float)(RAND_MAX / 2) - 1) * settings.maxBound;
-		float y = ((float)rand() / (float)(RAND_MAX / 2) - 1) * settings.maxBound;
-		float z = ((float)rand() / (float)(RAND_MAX / 2) - 1) * settings.maxBound;
-		agents[i].position = Vector3(x, y, z);
+		float distance = 0;
+		Vector3 gradient;
+		int attempts = 0;
+
+		// Don't spawn agents inside obstacles
+		do {
+			float x = ((float)rand() / (float)(RAND_MAX / 2) - 1) * settings.maxBound;
+			float y = ((float)rand() / (float)(RAND_MAX / 2) - 1) * settings.maxBound;
+			float z = ((float)rand() / (float)(RAND_MAX / 2) - 1) * settings.maxBound;
+			agents[i].position = Vector3(x, y, z);
+		} while (obstacleField.Lookup(agents[i].position, distance, gradient) && distance < 0 && ++attempts < 100);
+
 		agents[i].velocity = Vector3((float)rand() / (float)(RAND_MAX / 2) - 1, (float)rand() / (float)(RAND_MAX / 2) - 1, (float)rand() / (float)(RAND_MAX / 2) - 1).Normalised() * settings.maxVelocity;
 		agents[i].cell = int((agents[i].position.x + settings.maxBound) * cellDimensionReciprocal) + int((agents[i].position.y + settings.maxBound) * cellDimensionReciprocal) * cellsPerAxis + int((agents[i].position.z + settings.maxBound) * cellDimensionReciprocal) * cellsPerAxis * cellsPerAxis;
 	}
 
 	flock = new Flock(agents, settings);
+	controls = flock;
 
 	glGenBuffers(1, &bufFlock);
 	glBindBuffer(GL_ARRAY_BUFFER, bufFlock);
 	glBufferData(GL_ARRAY_BUFFER, numAgents * sizeof(Agent), nullptr, GL_DYNAMIC_COPY);
 
+	glGenBuffers(1, &bufFlockPrevious);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, bufFlockPrevious);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, numAgents * sizeof(Agent), flock->agents, GL_DYNAMIC_COPY);
+
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, bufFlock);
 	glBufferData(GL_SHADER_STORAGE_BUFFER, numAgents * sizeof(Agent), flock->agents, GL_DYNAMIC_COPY);
 }
 
 void NCL::Simulation::UpdateKeys(float dt) {
 	if (Window::GetKeyboard()->KeyDown(KeyboardKeys::NUM1)) {
-		flock->alignmentWeight += 0.1 * dt;
-		flock->alignmentWeight = fmin(1.0f, flock->alignmentWeight);
+		controls->alignmentWeight += 0.1 * dt;
+		controls->alignmentWeight = fmin(1.0f, controls->alignmentWeight);
 	}
 	if (Window::GetKeyboard()->KeyDown(KeyboardKeys::NUM2)) {
-		flock->alignmentWeight -= 0.1 * dt;
-		flock->alignmentWeight = fmax(0.0f, flock->alignmentWeight);
+		controls->alignmentWeight -= 0.1 * dt;
+		controls->alignmentWeight = fmax(0.0f, controls->alignmentWeight);
 	}
 
 	if (Window::GetKeyboard()->KeyDown(KeyboardKeys::NUM3)) {
-		flock->separationWeight += 0.1 * dt;
-		flock->separationWeight = fmin(1.0f, flock->separationWeight);
+		controls->separationWeight += 0.1 * dt;
+		controls->separationWeight = fmin(1.0f, controls->separationWeight);
 	}
 	if (Window::GetKeyboard()->KeyDown(KeyboardKeys::NUM4)) {
-		flock->separationWeight -= 0.1 * dt;
-		flock->separationWeight = fmax(0.0f, flock->separationWeight);
+		controls->separationWeight -= 0.1 * dt;
+		controls->separationWeight = fmax(0.0f, controls->separationWeight);
 	}
 
 	if (Window::GetKeyboard()->KeyDown(KeyboardKeys::NUM5)) {
-		flock->cohesionWeight += 0.1 * dt;
-		flock->cohesionWeight = fmin(1.0f, flock->cohesionWeight);
+		controls->cohesionWeight += 0.1 * dt;
+		controls->cohesionWeight = fmin(1.0f, controls->cohesionWeight);
 	}
 	if (Window::GetKeyboard()->KeyDown(KeyboardKeys::NUM6)) {
-		flock->cohesionWeight -= 0.1 * dt;
-		flock->cohesionWeight = fmax(0.0f, flock->cohesionWeight);
+		controls->cohesionWeight -= 0.1 * dt;
+		controls->cohesionWeight = fmax(0.0f, controls->cohesionWeight);
 	}
 
 	if (Window::GetKeyboard()->KeyPressed(KeyboardKeys::G)) {
@@ -101,6 +209,116 @@ void NCL::Simulation::UpdateKeys(float dt) {
 	if (Window::GetKeyboard()->KeyPressed(KeyboardKeys::B)) {
 		drawBox = !drawBox;
 	}
+	if (Window::GetKeyboard()->KeyPressed(KeyboardKeys::M)) {
+		controls->boundaryMode = controls->boundaryMode == BoundaryMode::Wrap ? BoundaryMode::Contain : BoundaryMode::Wrap;
+	}
+	if (Window::GetKeyboard()->KeyPressed(KeyboardKeys::F5)) {
+		SaveCheckpoint(settings.checkpointFile);
+	}
+	if (Window::GetKeyboard()->KeyPressed(KeyboardKeys::F9)) {
+		LoadCheckpoint(settings.checkpointFile);
+	}
+}
+
+bool NCL::Simulation::SaveCheckpoint(const std::string& filename) {
+	if (!CanCheckpoint()) {
+		std::cout << "Checkpoints aren't available in this mode" << std::endl;
+		return false;
+	}
+	auto start = std::chrono::high_resolution_clock::now();
+
+	CheckpointWriter writer;
+	WriteSettings(writer, settings);
+	WriteCheckpoint(writer);
+	if (!writer.SaveToFile(filename)) {
+		return false;
+	}
+
+	std::chrono::duration<float, std::milli> time = std::chrono::high_resolution_clock::now() - start;
+	std::cout << "Checkpoint saved: " << filename << " (" << time.count() << "ms)" << std::endl;
+	return true;
+}
+
+bool NCL::Simulation::LoadCheckpoint(const std::string& filename) {
+	auto start = std::chrono::high_resolution_clock::now();
+
+	CheckpointReader reader(filename);
+	Settings saved;
+	if (!reader.Valid() || !ReadSettings(reader, saved)) {
+		return false;
+	}
+	// Only the state is restored, so it has to fit the flock that is running
+	if (saved.numAgents != settings.numAgents || saved.maxBound != settings.maxBound) {
+		std::cout << "Checkpoint " << filename << " holds " << saved.numAgents << " agents in a bound of " << saved.maxBound
+			<< ", so it can't be restored into this simulation" << std::endl;
+		return false;
+	}
+	if (!LoadCheckpoint(reader)) {
+		return false;
+	}
+
+	std::chrono::duration<float, std::milli> time = std::chrono::high_resolution_clock::now() - start;
+	std::cout << "Checkpoint restored: " << filename << " (" << time.count() << "ms)" << std::endl;
+	return true;
+}
+
+bool NCL::Simulation::LoadCheckpoint(CheckpointReader& reader) {
+	if (!CanCheckpoint()) {
+		std::cout << "Checkpoints aren't available in this mode" << std::endl;
+		return false;
+	}
+	if (!ReadCheckpoint(reader)) {
+		std::cout << "Checkpoint ended early, so the simulation may be partly restored" << std::endl;
+		return false;
+	}
+	// Nothing to blend from until the next step
+	UploadAgents(flock->agents, flock->agents);
+	return true;
+}
+
+void NCL::Simulation::WriteSettings(CheckpointWriter& writer, const Settings& settings) {
+	TransferSettings(writer, settings);
+}
+
+bool NCL::Simulation::ReadSettings(CheckpointReader& reader, Settings& settings) {
+	TransferSettings(reader, settings);
+	return reader.Valid();
+}
+
+// gameTime is also what the random numbers are seeded from each frame, so restoring it restores them
+void NCL::Simulation::WriteCheckpoint(CheckpointWriter& writer) {
+	writer.Write(gameTime);
+	writer.Write(stepAccumulator);
+	writer.Write(paused);
+
+	writer.Write(flock->alignmentWeight);
+	writer.Write(flock->separationWeight);
+	writer.Write(flock->cohesionWeight);
+	writer.Write(flock->avoidanceWeight);
+	writer.Write(flock->obstacleWeight);
+	writer.Write(flock->boundaryMode);
+
+	writer.WriteArray(flock->agents, numAgents);
+	writer.WriteArray(flock->agentIds.data(), numAgents);
+	writer.WriteArray(flock->agentSlots.data(), numAgents);
+}
+
+bool NCL::Simulation::ReadCheckpoint(CheckpointReader& reader) {
+	reader.Read(gameTime);
+	reader.Read(stepAccumulator);
+	reader.Read(paused);
+
+	reader.Read(flock->alignmentWeight);
+	reader.Read(flock->separationWeight);
+	reader.Read(flock->cohesionWeight);
+	reader.Read(flock->avoidanceWeight);
+	reader.Read(flock->obstacleWeight);
+	reader.Read(flock->boundaryMode);
+
+	reader.ReadArray(flock->agents, numAgents);
+	reader.ReadArray(flock->agentIds.data(), numAgents);
+	reader.ReadArray(flock->agentSlots.data(), numAgents);
+	return reader.Valid();
 }
 
 void NCL::Simulation::UpdateStats(float dt) {
@@ -110,6 +328,73 @@ void NCL::Simulation::UpdateStats(float dt) {
 	srand((int)(gameTime * 1000.0f));
 }
 
+// The same steps run whatever the frame rate, so dynamics don't change under load. Once more than
+// maxStepsPerFrame steps are owed the rest are dropped, slowing the simulation rather than spiralling.
+// Without a limit every owed step runs.
+int NCL::Simulation::ConsumeSteps(float dt) {
+	if (fixedStep <= 0) {
+		return 1;
+	}
+	stepAccumulator += dt;
+
+	int steps = (int)(stepAccumulator / fixedStep);
+	if (settings.maxStepsPerFrame > 0 && steps > settings.maxStepsPerFrame) {
+		steps = settings.maxStepsPerFrame;
+		stepAccumulator = fmod(stepAccumulator, fixedStep);
+	}
+	else {
+		stepAccumulator -= steps * fixedStep;
+	}
+	return steps;
+}
+
+float NCL::Simulation::InterpolationFactor() const {
+	if (fixedStep <= 0) {
+		return 1.0f;
+	}
+	return fmin(1.0f, stepAccumulator / fixedStep);
+}
+
+void NCL::Simulation::UploadAgents(const Agent* previous, const Agent* current) {
+	if (BlendsSteps()) {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufFlockPrevious);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, numAgents * sizeof(Agent), previous, GL_DYNAMIC_COPY);
+	}
+
+	// Left bound, as the other uploads assume
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufFlock);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, numAgents * sizeof(Agent), current, GL_DYNAMIC_COPY);
+}
+
+void NCL::Simulation::UpdateInteractionField() {
+	GatherInteractionSources(frameSources);
+	BuildInteractionField(frameSources);
+}
+
+void NCL::Simulation::GatherInteractionSources(std::vector<InteractionSource>& sources) {
+	sources.clear();
+
+	bool attracting = Window::GetMouse()->ButtonDown(MouseButtons::RIGHT);
+	mouseRayActive = Window::GetMouse()->ButtonDown(MouseButtons::LEFT) || attracting;
+
+	if (mouseRayActive) {
+		Camera* c = renderer->GetCamera();
+		Ray r = Ray(c->GetPosition(), Quaternion::EulerAnglesToQuaternion(c->GetPitch(), c->GetYaw(), 0) * Vector3(0, 0, -1));
+
+		mouseRay = InteractionSource::Line(r.GetPosition(), r.GetPosition() + r.GetDirection().Normalised() * 100000, settings.avoidanceRadius, attracting ? 1.0f : -1.0f);
+		sources.push_back(mouseRay);
+	}
+	sources.insert(sources.end(), scriptedSources.begin(), scriptedSources.end());
+}
+
+void NCL::Simulation::BuildInteractionField(const std::vector<InteractionSource>& sources) {
+	interactionField.Clear();
+	for (const InteractionSource& source : sources) {
+		interactionField.Add(source);
+	}
+	interactionField.Build(settings.maxBound);
+}
+
 void NCL::Simulation::DrawUIText() {
 	renderer->DrawString("FPS: " + std::to_string(1 / dtPrev),
 		Vector2(1, 2), Vector4(0.5f, 0.3f, 0.8f, 1), 10.0f);
@@ -120,13 +405,18 @@ void NCL::Simulation::DrawUIText() {
 	renderer->DrawString("Num Agents: " + std::to_string(numAgents),
 		Vector2(82, 2), Vector4(0.5f, 0.3f, 0.8f, 1), 10.0f);
 
-	renderer->DrawString("[+1 | -2] Alignment: " + std::to_string(flock->alignmentWeight),
+	if (controls->HasLimitedView()) {
+		renderer->DrawString("FOV Rejected: " + std::to_string(fovRejected),
+			Vector2(1, 6), Vector4(0.5f, 0.3f, 0.8f, 1), 10.0f);
+	}
+
+	renderer->DrawString("[+1 | -2] Alignment: " + std::to_string(controls->alignmentWeight),
 		Vector2(1, 99), Vector4(0.5f, 0.3f, 0.8f, 1), 10.0f);
 
-	renderer->DrawString("[+3 | -4] Separation: " + std::to_string(flock->separationWeight),
+	renderer->DrawString("[+3 | -4] Separation: " + std::to_string(controls->separationWeight),
 		Vector2(37, 99), Vector4(0.5f, 0.3f, 0.8f, 1), 10.0f);
 
-	renderer->DrawString("[+5 | -6] Cohesion: " + std::to_string(flock->cohesionWeight),
+	renderer->DrawString("[+5 | -6] Cohesion: " + std::to_string(controls->cohesionWeight),
 		Vector2(73, 99), Vector4(0.5f, 0.3f, 0.8f, 1), 10.0f);
 }
 
@@ -1,11 +1,22 @@
 #pragma once
+#include "Checkpoint.h"
 #include "FlockingRenderer.h"
+#include "InteractionField.h"
+#include "ObstacleField.h"
+#include "ThreadPool.h"
+#include <atomic>
 
 namespace NCL {
 	class Flock;
+	struct Agent;
 
 	class Simulation {
 	public:
+		enum class BoundaryMode {
+			Wrap,
+			Contain
+		};
+
 		struct Settings {
 			int numAgents;
 
@@ -24,13 +35,100 @@ namespace NCL {
 
 			float maxBound;
 			float modelScale;
+
+			std::string obstacleFile;
+			float obstacleWeight;
+			float obstacleRange;
+
+			BoundaryMode boundaryMode;
+			float containMargin;
+
+			float alignmentFOV;
+			float separationFOV;
+			float cohesionFOV;
+
+			int pipelineDepth;
+
+			bool asyncSimulation;
+			float simulationRate;
+
+			bool numaAware;
+
+			float amortisedBudget;
+
+			// Morton reordering of the CPU agents, off while reorderInterval is 0
+			int reorderInterval;
+			float reorderDisorder;
+
+			int candidateCap;
+
+			// Steps between refreshes of each rule's neighbour sums, reused in between
+			int alignmentInterval;
+			int separationInterval;
+			int cohesionInterval;
+
+			// Level of detail by distance from the camera, off while lodNearDistance is 0. Tiers past each
+			// distance, and agents outside the view, steer every lodInterval steps from at most lodCap neighbours.
+			float lodNearDistance;
+			float lodFarDistance;
+			float lodHysteresis;
+			int lodMidInterval;
+			int lodFarInterval;
+			int lodMidCap;
+			int lodFarCap;
+
+			// Steps per second, independent of the frame rate. 0 steps once per frame with the frame time.
+			float fixedStepRate;
+			// 0 or less never drops owed steps
+			int maxStepsPerFrame;
+
+			// Splits the world into domainCount slabs along x, each stepped by its own process, off while it is 0 or 1.
+			// Ranks talk over local sockets at domainSocketPath-<rank>.
+			int domainCount;
+			int domainRank;
+			std::string domainSocketPath;
+
+			// NUMA slabs and domains are redrawn by measured cost once the busiest is balanceThreshold above the
+			// mean, at most every balanceInterval steps. 0 keeps the first split.
+			float balanceThreshold;
+			int balanceInterval;
+
+			// Publishes every step to a shared memory segment of this name that viewers can attach to, off while empty
+			std::string sharedStateName;
+
+			// Where F5 saves the state of the whole simulation and F9 restores it from
+			std::string checkpointFile;
+
+			// Records every agent's position and velocity every trajectoryInterval steps to this file, off while empty.
+			// Compressed in blocks of trajectoryBlockFrames frames, with positions and velocities quantised to
+			// trajectoryBits bits, or raw floats while trajectoryBits is 0.
+			std::string trajectoryFile;
+			int trajectoryInterval;
+			int trajectoryBits;
+			int trajectoryBlockFrames;
 		};
 
 		Simulation(Settings simSettings, FlockingRenderer* renderer);
-		~Simulation();
+		virtual ~Simulation();
 
 		virtual void Update(float dt) = 0;
 
+		bool SaveCheckpoint(const std::string& filename);
+		bool LoadCheckpoint(const std::string& filename);
+		// Restores from a checkpoint whose settings have already been read, as when one is resumed at launch
+		bool LoadCheckpoint(CheckpointReader& reader);
+
+		static void WriteSettings(CheckpointWriter& writer, const Settings& settings);
+		static bool ReadSettings(CheckpointReader& reader, Settings& settings);
+
+		void AddScriptedSource(const InteractionSource& source) {
+			scriptedSources.push_back(source);
+		}
+
+		void ClearScriptedSources() {
+			scriptedSources.clear();
+		}
+
 	protected:
 
 		void InitFlock();
@@ -38,26 +136,70 @@ namespace NCL {
 		virtual void PerformFlock(float dt) = 0;
 		virtual void UpdateKeys(float dt);
 
+		// Whether the main thread can read and replace the live flock, which it can't while another thread steps it
+		virtual bool CanCheckpoint() const {
+			return true;
+		}
+		// Each simulation adds the state of its own after the state every simulation shares
+		virtual void WriteCheckpoint(CheckpointWriter& writer);
+		virtual bool ReadCheckpoint(CheckpointReader& reader);
+
 		void UpdateStats(float dt);
 
+		// Adds the frame time to the accumulator and returns how many fixed steps are due
+		int ConsumeSteps(float dt);
+		float StepDuration(float dt) const {
+			return fixedStep > 0 ? fixedStep : dt;
+		}
+		// How far the renderer is between the previous and the current step
+		float InterpolationFactor() const;
+		// Without fixed steps the latest step is drawn as it is, so the state before it is never needed
+		bool BlendsSteps() const {
+			return fixedStep > 0;
+		}
+		// previous is only uploaded while steps are blended
+		void UploadAgents(const Agent* previous, const Agent* current);
+
+		void UpdateInteractionField();
+		void GatherInteractionSources(std::vector<InteractionSource>& sources);
+		void BuildInteractionField(const std::vector<InteractionSource>& sources);
+
 		void DrawUIText();
 		void DrawRadii(const Vector3& position, float radius, const Vector4& colour = Vector4(1, 1, 1, 1));
 
 		void SaveScreen();
 
 		FlockingRenderer* renderer;
+		ThreadPool* threadPool;
 		GLuint bufFlock;
+		// State before the latest step, which the renderer blends towards bufFlock
+		GLuint bufFlockPrevious;
 
 		float gameTime;
 		float fpsSmoothing;
 		float dtPrev;
 
+		float fixedStep;
+		float stepAccumulator;
+
 		bool showRadii;
 		bool paused;
 		bool drawBox;
 
 		int numAgents;
 		Flock* flock;
+		// Weights edited by the keys and shown in the UI. The same flock, unless it is stepped on another thread
+		Flock* controls;
+
+		std::atomic<int> fovRejected;
+
+		ObstacleField obstacleField;
+		InteractionField interactionField;
+		std::vector<InteractionSource> scriptedSources;
+		std::vector<InteractionSource> frameSources;
+
+		InteractionSource mouseRay;
+		bool mouseRayActive;
 
 		Settings settings;
 	};
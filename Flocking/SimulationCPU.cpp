@@ -1,12 +1,33 @@
 #include "SimulationCPU.h"
 #include "Flock.h"
+#include "LocalSocketTransport.h"
+#include <chrono>
 #include <functional>
+#include <iostream>
+#include <thread>
 #include "../Common/Maths.h"
-#include "../Common/Quaternion.h"
-#include "../Common/Camera.h"
 
 using namespace NCL;
 
+namespace {
+	// Spreads the low 10 bits of v so there are two zero bits between each
+	inline uint32_t SpreadBits(uint32_t v) {
+		v &= 0x3ff;
+		v = (v | (v << 16)) & 0x030000ff;
+		v = (v | (v << 8)) & 0x0300f00f;
+		v = (v | (v << 4)) & 0x030c30c3;
+		v = (v | (v << 2)) & 0x09249249;
+		return v;
+	}
+
+	// cos(angle to neighbour) >= cos(fov / 2), compared as x|x| on both sides so neither length needs a sqrt.
+	// facing = dot(velocity, toNeighbour), lengthProduct = |velocity|^2 * |toNeighbour|^2. A full circle of view
+	// passes straight away, as rounding can put an exactly opposite neighbour just under the threshold of -1.
+	inline bool WithinView(float facing, float lengthProduct, float viewThreshold) {
+		return viewThreshold <= -1.0f || facing * fabs(facing) >= viewThreshold * lengthProduct;
+	}
+}
+
 SimulationCPU::SimulationCPU(bool octree, Simulation::Settings simSettings, FlockingRenderer* renderer) : Simulation(simSettings, renderer) {
 	showOctree = false;
 	useOctree = octree;
@@ -14,24 +35,220 @@ SimulationCPU::SimulationCPU(bool octree, Simulation::Settings simSettings, Floc
 	octreeMaxDepth = 4;
 	octreeMaxSize = 15;
 
+	// Two tiles of agents plus their partial sums should stay resident in a 32KB L1
+	const int tileCacheBudget = 32 * 1024;
+	useTiling = false;
+	tileSize = (int)fmax(32, tileCacheBudget / (2 * (sizeof(Agent) + sizeof(NeighbourSums))));
+
 	InitFlock();
 
+	sliceCount = 1;
+	currentSlice = 0;
+	steeringCostPerAgent = 0;
+	lastAcceleration.resize(numAgents);
+
+	// Everything starts far and is promoted on the first step
+	lodTiers.assign(numAgents, FarTier);
+	lodIntervals[NearTier] = 1;
+	lodIntervals[MidTier] = (int)fmax(1, settings.lodMidInterval);
+	lodIntervals[FarTier] = (int)fmax(1, settings.lodFarInterval);
+	lodCaps[NearTier] = 0;
+	lodCaps[MidTier] = settings.lodMidCap;
+	lodCaps[FarTier] = settings.lodFarCap;
+	for (int i = 0; i < TierCount; ++i) {
+		lodTierCounts[i] = 0;
+	}
+
+	stepsSinceReorder = 0;
+	localityDisorder = 0;
+	mortonKeys.resize(numAgents);
+	reorderOrder.resize(numAgents);
+
+	// Cells one search radius wide, matching the GPU grid, so the 27 surrounding cells cover every neighbour
+	useGrid = false;
+	gridBuildTime = 0;
+	grid.Init(flock->maxBound, flock->maxRadius, numAgents);
+
+	numa = nullptr;
+	if (settings.numaAware) {
+		numa = new NumaPartitioner(settings.balanceThreshold, settings.balanceInterval);
+		numa->Distribute(flock);
+		numa->SetSwapCallback([this](int slotA, int slotB) {
+			SwapSlotState(slotA, slotB);
+		});
+		std::cout << "NUMA aware partitioning across " << numa->NumNodes() << " node(s)" << std::endl;
+	}
+
+	neighbourSums.resize(numAgents);
+	agentCosts.assign(numAgents, 1.0f);
+
+	domain = nullptr;
+	if (settings.domainCount > 1 && !numa) {
+		domain = new DomainDecomposition(new LocalSocketTransport(settings.domainSocketPath, settings.domainRank, settings.domainCount), flock->maxBound, flock->maxRadius,
+			settings.balanceThreshold, settings.balanceInterval);
+		// Migrants arrive with stale cached sums in their new slots, which the next refresh of each rule replaces
+		domain->SetSwapCallback([this](int slotA, int slotB) {
+			SwapSlotState(slotA, slotB);
+		});
+		std::cout << "Domain rank " << domain->Rank() << " of " << domain->NumRanks() << std::endl;
+	}
+
+	// Amortised steps take over the whole step whenever they run, so say which other settings they leave idle
+	if (settings.amortisedBudget > 0 && !domain) {
+		std::string overridden;
+		if (useOctree) {
+			overridden += " octree";
+		}
+		if (numa) {
+			overridden += " numaAware";
+		}
+		if (settings.lodNearDistance > 0) {
+			overridden += " lodNearDistance";
+		}
+		if (!overridden.empty()) {
+			std::cout << "amortisedBudget overrides:" << overridden << std::endl;
+		}
+	}
+
+	alignmentInterval = (int)fmax(1, settings.alignmentInterval);
+	separationInterval = (int)fmax(1, settings.separationInterval);
+	cohesionInterval = (int)fmax(1, settings.cohesionInterval);
+	ruleStep = 0;
+	cachedSums.resize(numAgents);
+	CandidateBuffer::SetCap(settings.candidateCap);
+	if (domain) {
+		domain->Distribute(flock);
+	}
+
+	// Steps depend on each other, so only one can be in flight and deeper pipelines would only add latency
+	pipelineDepth = (int)fmax(1, fmin(2, settings.pipelineDepth));
+	// Ranks step in lockstep through the exchange, and the renderer has to draw the owned count of the step it shows
+	if (domain) {
+		pipelineDepth = 1;
+		settings.asyncSimulation = false;
+	}
+	stepSlot = 0;
+	stepsLaunched = false;
+	frameGraph = new TaskGraph(threadPool);
+
+	for (int i = 0; i < pipelineDepth; ++i) {
+		Agent* snapshot = new Agent[numAgents];
+		memcpy(snapshot, flock->agents, numAgents * sizeof(Agent));
+		snapshots.push_back(snapshot);
+
+		Agent* previous = new Agent[numAgents];
+		memcpy(previous, flock->agents, numAgents * sizeof(Agent));
+		previousSnapshots.push_back(previous);
+
+		frameArenas.push_back(new FrameArena());
+		snapshotTrees.push_back(new Octree(Vector3(1, 1, 1) * flock->maxBound, octreeMaxDepth, octreeMaxSize, frameArenas[i]));
+	}
+
+	stepCount = 0;
+	sharedState = settings.sharedStateName.empty() ? nullptr :
+		SharedFlockState::Create(settings.sharedStateName, numAgents, settings.maxBound, settings.modelScale);
+	// A domain only holds part of the flock, and the slots of its ghosts change every step
+	trajectory = settings.trajectoryFile.empty() || domain ? nullptr :
+		TrajectoryRecorder::Create(settings.trajectoryFile, numAgents, settings.maxBound, settings.maxVelocity, settings.trajectoryInterval,
+			settings.trajectoryBits, settings.trajectoryBlockFrames);
+
+	asyncSimulation = settings.asyncSimulation;
+	simulationRunning = false;
+	if (asyncSimulation) {
+		StartSimulationThread();
+	}
+
 	Debug::SetRenderer(renderer);
 	renderer->InitFlock(bufFlock, numAgents, settings.maxBound, settings.modelScale);
 }
 
+SimulationCPU::~SimulationCPU() {
+	if (asyncSimulation) {
+		simulationRunning = false;
+		simulationThread.join();
+	}
+	delete frameGraph;
+	// The flock is destroyed later by Simulation, but no longer owns its agents
+	delete numa;
+	delete domain;
+	delete sharedState;
+	delete trajectory;
+
+	for (int i = 0; i < pipelineDepth; ++i) {
+		delete[] snapshots[i];
+		delete[] previousSnapshots[i];
+		delete snapshotTrees[i];
+		delete frameArenas[i];
+	}
+}
+
 void SimulationCPU::Update(float dt) {
 	srand((int)(gameTime * 1000.0f));
 
 	renderer->UpdateCamera(dt);
 
+	// Keys and interaction sources feed the next step, so the step in flight has to finish first
+	frameGraph->Wait();
+
 	UpdateStats(dt);
 	UpdateKeys(dt);
 
-	PerformFlock(dt);
+	// Steps stop while paused, so viewers go by the frames instead
+	if (sharedState) {
+		sharedState->Beat();
+	}
+
+	if (asyncSimulation) {
+		PublishInput();
+		PresentLatestSnapshot();
+	}
+	else if (pipelineDepth > 1) {
+		UpdateInteractionField();
+		lodView = CurrentLodView();
+		PerformFlockPipelined(dt);
+	}
+	else {
+		UpdateInteractionField();
+		lodView = CurrentLodView();
+		PerformFlock(dt);
+	}
 
 	DrawUIText();
+	if (numa) {
+		renderer->DrawString("NUMA Local Reads: " + std::to_string((int)(numa->LocalAccessRatio() * 100)) + "% (" + std::to_string(numa->NumNodes()) + " nodes, " + std::to_string(numa->LastMigrated()) + " migrated, imbalance " + std::to_string(numa->Imbalance()) + ")",
+			Vector2(1, 10), Vector4(0.5f, 0.3f, 0.8f, 1), 10.0f);
+	}
+	if (settings.amortisedBudget > 0 && !domain) {
+		// The octree, grid and tiling keys still toggle, but do nothing until amortised steps are off
+		std::string overridden = std::string(useOctree ? " octree" : "") + (useGrid ? " grid" : "") + (useTiling ? " tiling" : "");
+		renderer->DrawString("Steering Slices: 1/" + std::to_string(sliceCount.load()) + (overridden.empty() ? "" : ", overriding" + overridden),
+			Vector2(1, 18), Vector4(0.5f, 0.3f, 0.8f, 1), 10.0f);
+	}
+	if (useGrid && !useOctree) {
+		renderer->DrawString("Grid Build: " + std::to_string(gridBuildTime.load()) + "ms",
+			Vector2(1, 14), Vector4(0.5f, 0.3f, 0.8f, 1), 10.0f);
+	}
+	if (domain) {
+		renderer->DrawString("Domain " + std::to_string(domain->Rank() + 1) + "/" + std::to_string(domain->NumRanks()) + ": " + std::to_string(domain->OwnedCount()) + " owned, " + std::to_string(domain->GhostCount()) + " ghosts, " + std::to_string(domain->LastMigrated()) + " migrated, exchange " + std::to_string(domain->LastExchangeTime()) + "ms, imbalance " + std::to_string(domain->Imbalance()),
+			Vector2(1, 34), Vector4(0.5f, 0.3f, 0.8f, 1), 10.0f);
+	}
+	if (settings.lodNearDistance > 0) {
+		renderer->DrawString("LOD Near/Mid/Far: " + std::to_string(lodTierCounts[NearTier].load()) + "/" + std::to_string(lodTierCounts[MidTier].load()) + "/" + std::to_string(lodTierCounts[FarTier].load()),
+			Vector2(1, 30), Vector4(0.5f, 0.3f, 0.8f, 1), 10.0f);
+	}
+	if (trajectory) {
+		renderer->DrawString("Trajectory: " + std::to_string(trajectory->FramesRecorded()) + " frames recorded, " + std::to_string(trajectory->FramesDropped()) + " skipped",
+			Vector2(1, 38), Vector4(0.5f, 0.3f, 0.8f, 1), 10.0f);
+	}
+	renderer->DrawString("Candidate Allocations: " + std::to_string(CandidateBuffer::Allocations()) + " (" + std::to_string(CandidateBuffer::Capped()) + " capped)",
+		Vector2(1, 22), Vector4(0.5f, 0.3f, 0.8f, 1), 10.0f);
+	FrameArena* arena = frameArenas[stepSlot];
+	renderer->DrawString("Frame Arena: " + std::to_string(arena->LastFrameBytes() / 1024) + "KB (peak " + std::to_string(arena->HighWaterMark() / 1024) + "KB, " + std::to_string(arena->LastBlockAllocations()) + " heap blocks)",
+		Vector2(1, 26), Vector4(0.5f, 0.3f, 0.8f, 1), 10.0f);
 	renderer->DrawBoundingBox(drawBox ? flock->maxBound : 0);
+	if (drawBox) {
+		obstacleField.DebugDraw();
+	}
 	Debug::FlushRenderables(dt);
 	renderer->Render();
 }
@@ -45,159 +262,1001 @@ void SimulationCPU::UpdateKeys(float dt) {
 	if (Window::GetKeyboard()->KeyPressed(KeyboardKeys::O)) {
 		showOctree = !showOctree;
 	}
+	if (Window::GetKeyboard()->KeyPressed(KeyboardKeys::T)) {
+		useTiling = !useTiling;
+	}
+	if (Window::GetKeyboard()->KeyPressed(KeyboardKeys::Y)) {
+		useGrid = !useGrid;
+	}
+	// The benchmark reads the live flock, which belongs to the simulation thread in async mode
+	if (Window::GetKeyboard()->KeyPressed(KeyboardKeys::J) && !asyncSimulation) {
+		BenchmarkOctreeBuild();
+	}
+	// Steps every slot, which in a domain would also step agents other ranks own
+	if (Window::GetKeyboard()->KeyPressed(KeyboardKeys::H) && !asyncSimulation && !domain) {
+		BenchmarkMultiRate();
+	}
+}
+
+// Cached sums and last accelerations are what amortised and multi-rate steps steer from in between
+// refreshes, so without them a restored run would drift from the one that was saved
+void SimulationCPU::WriteCheckpoint(CheckpointWriter& writer) {
+	Simulation::WriteCheckpoint(writer);
+
+	writer.Write(ruleStep);
+	writer.Write(stepCount);
+	writer.Write(currentSlice);
+	writer.Write(steeringCostPerAgent);
+	writer.Write(stepsSinceReorder);
+
+	writer.WriteArray(lastAcceleration.data(), numAgents);
+	writer.WriteArray(cachedSums.data(), numAgents);
+	writer.WriteArray(lodTiers.data(), numAgents);
+	writer.WriteArray(agentCosts.data(), numAgents);
 }
 
+bool SimulationCPU::ReadCheckpoint(CheckpointReader& reader) {
+	Simulation::ReadCheckpoint(reader);
+
+	reader.Read(ruleStep);
+	reader.Read(stepCount);
+	reader.Read(currentSlice);
+	reader.Read(steeringCostPerAgent);
+	reader.Read(stepsSinceReorder);
+
+	reader.ReadArray(lastAcceleration.data(), numAgents);
+	reader.ReadArray(cachedSums.data(), numAgents);
+	reader.ReadArray(lodTiers.data(), numAgents);
+	reader.ReadArray(agentCosts.data(), numAgents);
+
+	// Whichever slot is drawn next shows the restored flock
+	for (int i = 0; i < pipelineDepth; ++i) {
+		memcpy(snapshots[i], flock->agents, numAgents * sizeof(Agent));
+		memcpy(previousSnapshots[i], flock->agents, numAgents * sizeof(Agent));
+	}
+	return reader.Valid();
+}
+
+// The simulation thread steps the real flock and the main thread keeps a copy of the tunable weights,
+// so the two only ever meet through the input and snapshot triple buffers.
+void SimulationCPU::StartSimulationThread() {
+	Simulation::Settings controlSettings = settings;
+	controlSettings.numAgents = 0;
+	controls = new Flock(new Agent[0], controlSettings);
+
+	for (int i = 0; i < 3; ++i) {
+		publishedAgents.Buffer(i).assign(flock->agents, flock->agents + numAgents);
+	}
+	PublishInput();
+
+	simulationRunning = true;
+	simulationThread = std::thread(&SimulationCPU::SimulationLoop, this);
+}
+
+void SimulationCPU::PublishInput() {
+	SimulationInput& input = inputs.WriteBuffer();
+
+	input.alignmentWeight = controls->alignmentWeight;
+	input.separationWeight = controls->separationWeight;
+	input.cohesionWeight = controls->cohesionWeight;
+	input.boundaryMode = controls->boundaryMode;
+
+	input.paused = paused;
+	input.useOctree = useOctree;
+	input.useGrid = useGrid;
+	input.useTiling = useTiling;
+
+	input.view = CurrentLodView();
+	GatherInteractionSources(input.sources);
+
+	inputs.Publish();
+}
+
+void SimulationCPU::PresentLatestSnapshot() {
+	// The simulation thread keeps its own clock, so the newest snapshot is drawn as it is
+	renderer->SetInterpolation(1.0f);
+	if (publishedAgents.Acquire()) {
+		glBufferData(GL_SHADER_STORAGE_BUFFER, numAgents * sizeof(Agent), publishedAgents.ReadBuffer().data(), GL_DYNAMIC_COPY);
+	}
+	// The octree lives on the simulation thread, so only the radii can be drawn here
+	DrawFlockDebug(publishedAgents.ReadBuffer().data(), nullptr);
+}
+
+void SimulationCPU::SimulationLoop() {
+	typedef std::chrono::steady_clock Clock;
+
+	Clock::duration period = settings.simulationRate > 0 ?
+		std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(1.0f / settings.simulationRate)) : Clock::duration::zero();
+	Clock::time_point previous = Clock::now();
+	Clock::time_point nextStep = previous + period;
+
+	while (simulationRunning) {
+		if (period > Clock::duration::zero()) {
+			std::this_thread::sleep_until(nextStep);
+			nextStep += period;
+
+			// Steps that were missed are dropped rather than run back to back
+			if (Clock::now() > nextStep) {
+				nextStep = Clock::now() + period;
+			}
+		}
+
+		Clock::time_point now = Clock::now();
+		float dt = period > Clock::duration::zero() ? 1.0f / settings.simulationRate : std::chrono::duration<float>(now - previous).count();
+		previous = now;
+
+		inputs.Acquire();
+		const SimulationInput& input = inputs.ReadBuffer();
+
+		if (input.paused) {
+			if (period == Clock::duration::zero()) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			continue;
+		}
+
+		flock->alignmentWeight = input.alignmentWeight;
+		flock->separationWeight = input.separationWeight;
+		flock->cohesionWeight = input.cohesionWeight;
+		flock->boundaryMode = input.boundaryMode;
+		BuildInteractionField(input.sources);
+		lodView = input.view;
+
+		PrepareStep(0, input.useOctree);
+		StepAgents(*snapshotTrees[0], dt, input.useOctree, input.useGrid, input.useTiling);
+		RecordStep();
+
+		std::vector<Agent>& snapshot = publishedAgents.WriteBuffer();
+		memcpy(snapshot.data(), flock->agents, numAgents * sizeof(Agent));
+		publishedAgents.Publish();
+		PublishStep(flock->agents);
+	}
+}
+
+// Hands the last step of a frame to whatever is watching the simulation. A domain only publishes the agents it owns.
+void SimulationCPU::PublishStep(const Agent* agents) {
+	if (sharedState) {
+		sharedState->Publish(agents, domain ? domain->OwnedCount() : numAgents, stepCount);
+	}
+}
+
+// Runs straight after every step, before anything can reorder the agents, so no due step is missed
+// however many run in a frame
+void SimulationCPU::RecordStep() {
+	if (trajectory) {
+		trajectory->Record(flock->agents, flock->agentSlots.data(), stepCount);
+	}
+}
+
+// Keeps what is stored per slot with its agent when the partitioner or domain swaps two slots
+void SimulationCPU::SwapSlotState(int slotA, int slotB) {
+	std::swap(lastAcceleration[slotA], lastAcceleration[slotB]);
+	std::swap(cachedSums[slotA], cachedSums[slotB]);
+	std::swap(agentCosts[slotA], agentCosts[slotB]);
+}
+
+uint32_t SimulationCPU::MortonCode(const Vector3& position) const {
+	float scale = 1023.0f / (2 * flock->maxBound);
+	Vector3 p = (position + Vector3(1, 1, 1) * flock->maxBound) * scale;
+
+	uint32_t x = (uint32_t)Maths::Clamp(p.x, 0.0f, 1023.0f);
+	uint32_t y = (uint32_t)Maths::Clamp(p.y, 0.0f, 1023.0f);
+	uint32_t z = (uint32_t)Maths::Clamp(p.z, 0.0f, 1023.0f);
+	return SpreadBits(x) | (SpreadBits(y) << 1) | (SpreadBits(z) << 2);
+}
+
+// Keeps agents that are close in space close in memory. The share of neighbouring slots whose Morton codes
+// run backwards measures how far the flock has drifted from Z order, and the agents are re-sorted when it
+// passes reorderDisorder or every reorderInterval steps. The previous order is the starting point, so the
+// radix sort usually finishes in its nearly-sorted path.
+void SimulationCPU::MaintainLocality() {
+	if (settings.reorderInterval <= 0 || numa || domain) {
+		return;
+	}
+	stepsSinceReorder++;
+
+	std::atomic<int> descents(0);
+	threadPool->ParallelFor(numAgents, 16384, [&](int begin, int end) {
+		int count = 0;
+		for (int i = begin; i < end; ++i) {
+			mortonKeys[i] = MortonCode(flock->agents[i].position);
+		}
+		// The previous chunk may not have written its last key yet
+		if (begin > 0) {
+			count += mortonKeys[begin] < MortonCode(flock->agents[begin - 1].position) ? 1 : 0;
+		}
+		for (int i = begin + 1; i < end; ++i) {
+			count += mortonKeys[i] < mortonKeys[i - 1] ? 1 : 0;
+		}
+		descents += count;
+	});
+	localityDisorder = (float)descents / numAgents;
+
+	if (stepsSinceReorder < settings.reorderInterval && localityDisorder < settings.reorderDisorder) {
+		return;
+	}
+
+	for (int i = 0; i < numAgents; ++i) {
+		reorderOrder[i] = i;
+	}
+	radixSort.Sort(mortonKeys, reorderOrder, threadPool);
+	flock->Permute(reorderOrder, threadPool);
+
+	reorderAcceleration.resize(numAgents);
+	reorderSums.resize(numAgents);
+	for (int i = 0; i < numAgents; ++i) {
+		reorderAcceleration[i] = lastAcceleration[reorderOrder[i]];
+		reorderSums[i] = cachedSums[reorderOrder[i]];
+	}
+	lastAcceleration.swap(reorderAcceleration);
+	cachedSums.swap(reorderSums);
+
+	stepsSinceReorder = 0;
+}
+
+// The slot's arena only holds its tree, so it is emptied whenever the tree is rebuilt
+void SimulationCPU::PrepareStep(int slot, bool octree) {
+	ruleStep++;
+	stepCount++;
+	fovRejected = 0;
+	CandidateBuffer::ResetStats();
+	MaintainLocality();
+	if (domain) {
+		domain->Exchange(flock, agentCosts);
+	}
+	// Slots move here rather than after the step, so the state kept from before the step still lines up with them
+	if (numa) {
+		numa->ResetStats();
+		numa->Rebalance(flock, agentCosts);
+		numa->Migrate(flock);
+	}
+
+	frameArenas[slot]->Reset();
+	snapshotTrees[slot]->Clear();
+	if (octree && !domain) {
+		snapshotTrees[slot]->Build(flock->agents, numAgents, threadPool);
+	}
+}
+
+// Runs however many fixed steps are due, keeping the state from before the last one so the
+// renderer can blend between the two. The last step's tree is drawn until the next step.
 void SimulationCPU::PerformFlock(float dt) {
-	Octree tree(Vector3(1, 1, 1) * flock->maxBound, octreeMaxDepth, octreeMaxSize);
+	int steps = paused ? 0 : ConsumeSteps(dt);
+
+	for (int i = 0; i < steps; ++i) {
+		PrepareStep(0, useOctree);
+		if (i == steps - 1 && BlendsSteps()) {
+			memcpy(previousSnapshots[0], flock->agents, numAgents * sizeof(Agent));
+		}
+		StepAgents(*snapshotTrees[0], StepDuration(dt), useOctree, useGrid, useTiling);
+		RecordStep();
+	}
+
+	DrawFlockDebug(flock->agents, snapshotTrees[0]);
+
+	if (steps > 0) {
+		PublishStep(flock->agents);
+		UploadAgents(previousSnapshots[0], flock->agents);
+		if (domain) {
+			renderer->SetAgentCount(domain->OwnedCount());
+		}
+	}
+	renderer->SetInterpolation(InterpolationFactor());
+}
+
+// Launches index build -> agent update for each step that is due, then a snapshot, on the workers,
+// and uploads and draws the last finished snapshot while they run. Costs one step of latency.
+void SimulationCPU::PerformFlockPipelined(float dt) {
+	int steps = paused ? 0 : ConsumeSteps(dt);
+	int presentSlot = stepSlot;
+	// The slot drawn this frame only holds anything new if last frame launched steps into it
+	bool presentChanged = stepsLaunched;
+	stepsLaunched = steps > 0;
+
+	if (steps > 0) {
+		stepSlot = (stepSlot + 1) % pipelineDepth;
+
+		int slot = stepSlot;
+		Agent* previous = previousSnapshots[slot];
+		Agent* snapshot = snapshots[slot];
+		float stepDuration = StepDuration(dt);
+
+		frameGraph->Clear();
+		std::vector<int> dependencies;
+		for (int i = 0; i < steps; ++i) {
+			bool savePrevious = i == steps - 1 && BlendsSteps();
+
+			int build = frameGraph->AddTask([this, slot]() {
+				PrepareStep(slot, useOctree);
+			}, dependencies);
+			int step = frameGraph->AddTask([this, slot, previous, savePrevious, stepDuration]() {
+				if (savePrevious) {
+					memcpy(previous, flock->agents, numAgents * sizeof(Agent));
+				}
+				StepAgents(*snapshotTrees[slot], stepDuration, useOctree, useGrid, useTiling);
+				RecordStep();
+			}, { build });
+			dependencies = { step };
+		}
+		frameGraph->AddTask([this, snapshot]() {
+			memcpy(snapshot, flock->agents, numAgents * sizeof(Agent));
+			PublishStep(snapshot);
+		}, dependencies);
+		frameGraph->Launch();
+	}
+
+	DrawFlockDebug(snapshots[presentSlot], snapshotTrees[presentSlot]);
+
+	if (presentChanged) {
+		UploadAgents(previousSnapshots[presentSlot], snapshots[presentSlot]);
+	}
+	renderer->SetInterpolation(InterpolationFactor());
+}
 
-	if (useOctree) {
+void SimulationCPU::StepAgents(Octree& tree, float dt, bool octree, bool gridSearch, bool tiled) {
+	if (domain) {
+		FlockDomain(dt);
+	}
+	else if (settings.amortisedBudget > 0) {
+		FlockAmortised(dt);
+	}
+	else if (settings.lodNearDistance > 0) {
+		FlockLod(dt);
+	}
+	else if (octree && numa) {
+		StepAgentsNuma(tree, dt);
+	}
+	else if (octree) {
+		// Agents move as they go here, so the whole flock is one chunk on this thread
+		CandidateBuffer buffer;
+		for (int i = 0; i < numAgents; ++i) {
+			FlockTree((*flock)[i], tree, buffer, dt);
+		}
+	}
+	else if (gridSearch) {
+		FlockGrid(dt);
+	}
+	else if (tiled) {
+		FlockTiled(dt);
+	}
+	else {
 		for (int i = 0; i < numAgents; ++i) {
-			tree.Insert((*flock)[i]);
+			FlockBruteForce((*flock)[i], flock->agentVector, dt);
 		}
 	}
+}
 
-	for (int i = 0; i < numAgents; ++i) {
-		Agent* a = (*flock)[i];
-		if (!paused) {
-			if (useOctree) {
-				FlockTree(a, tree, dt);
+// Each node's threads gather and apply the sums for their own slab, so every write and most reads
+// stay in local memory. Sums are gathered for every agent before any moves, as slabs run concurrently.
+void SimulationCPU::StepAgentsNuma(Octree& tree, float dt) {
+	numa->ForEachPartition([&](int node, int begin, int end) {
+		CandidateBuffer buffer;
+		int local = 0;
+		int remote = 0;
+		int rejected = 0;
+
+		for (int i = begin; i < end; ++i) {
+			Agent* a = (*flock)[i];
+			std::vector<int>& candidates = buffer.Begin();
+			tree.GetNeighbours(a->position, flock->maxRadius, candidates, false, buffer.MaxCount());
+			buffer.End();
+
+			agentCosts[i] = (float)candidates.size() + 1;
+			for (int candidate : candidates) {
+				if (numa->IsLocal(node, candidate)) {
+					local++;
+				}
+				else {
+					remote++;
+				}
+			}
+			rejected += GatherNeighbours(a, candidates, neighbourSums[i]);
+		}
+		numa->RecordAccesses(local, remote);
+		fovRejected += rejected;
+	});
+
+	numa->ForEachPartition([&](int, int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			ApplySums((*flock)[i], neighbourSums[i], dt);
+			neighbourSums[i] = NeighbourSums();
+		}
+	});
+}
+
+void SimulationCPU::DrawFlockDebug(const Agent* agents, Octree* tree) {
+	if (showRadii) {
+		for (int i = 0; i < numAgents; ++i) {
+			DrawRadii(agents[i].position, flock->alignmentRadius, Debug::BLUE);
+			DrawRadii(agents[i].position, flock->separationRadius, Debug::GREEN);
+			DrawRadii(agents[i].position, flock->cohesionRadius, Debug::RED);
+		}
+	}
+	if (useOctree && showOctree && tree) {
+		tree->DebugDraw();
+	}
+}
+
+// Times the octree build on the current flock with pools of 1 to 64 threads, and checks that
+// every pool produces the same agent order as the single threaded build.
+void SimulationCPU::BenchmarkOctreeBuild() {
+	const int repeats = 20;
+
+	std::vector<int> reference;
+	double singleThreadTime = 0.0;
+
+	std::cout << "Octree build scaling (" << numAgents << " agents, " << repeats << " builds per pool):" << std::endl;
+	for (int threads = 1; threads <= 64; threads *= 2) {
+		ThreadPool pool(threads);
+		FrameArena arena;
+		bool deterministic = true;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < repeats; ++i) {
+			arena.Reset();
+			Octree tree(Vector3(1, 1, 1) * flock->maxBound, octreeMaxDepth, octreeMaxSize, &arena);
+			tree.Build(flock->agents, numAgents, &pool);
+
+			if (reference.empty()) {
+				reference = tree.GetOrder();
 			}
-			else {
-				FlockBruteForce(a, flock->agentVector, dt);
+			else if (tree.GetOrder() != reference) {
+				deterministic = false;
 			}
 		}
-		if (showRadii) {
-			DrawRadii(a->position, flock->alignmentRadius, Debug::BLUE);
-			DrawRadii(a->position, flock->separationRadius, Debug::GREEN);
-			DrawRadii(a->position, flock->cohesionRadius, Debug::RED); 
+		auto end = std::chrono::high_resolution_clock::now();
+
+		double buildTime = std::chrono::duration<double, std::milli>(end - start).count() / repeats;
+		if (threads == 1) {
+			singleThreadTime = buildTime;
 		}
+		std::cout << "  " << threads << " threads: " << buildTime << "ms, speedup " << singleThreadTime / buildTime
+			<< (deterministic ? "" : " (layout differs from 1 thread!)") << std::endl;
 	}
+}
 
-	if (useOctree && showOctree) {
-		tree.DebugDraw();
+// Runs the same steps from the current state with every rule refreshed each step and then with the
+// configured intervals, and reports the cost of each and how far apart the two flocks end up.
+void SimulationCPU::BenchmarkMultiRate() {
+	const int steps = 120;
+	float dt = StepDuration(1.0f / 60.0f);
+
+	std::vector<Agent> start(flock->agents, flock->agents + numAgents);
+	std::vector<NeighbourSums> startSums = cachedSums;
+	int startStep = ruleStep;
+	int intervals[3] = { alignmentInterval, separationInterval, cohesionInterval };
+
+	auto run = [&](bool multiRate) {
+		memcpy(flock->agents, start.data(), numAgents * sizeof(Agent));
+		cachedSums = startSums;
+		ruleStep = 0;
+		alignmentInterval = multiRate ? intervals[0] : 1;
+		separationInterval = multiRate ? intervals[1] : 1;
+		cohesionInterval = multiRate ? intervals[2] : 1;
+
+		auto begin = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < steps; ++i) {
+			ruleStep++;
+			FlockGrid(dt);
+		}
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - begin).count() / steps;
+	};
+
+	double fullTime = run(false);
+	std::vector<Agent> reference(flock->agents, flock->agents + numAgents);
+	double multiTime = run(true);
+
+	// Per axis distances go the short way round, so wrapped agents don't count as diverged
+	double totalDivergence = 0;
+	float maxDivergence = 0;
+	for (int i = 0; i < numAgents; ++i) {
+		Vector3 offset = flock->agents[i].position - reference[i].position;
+		float x = fmin(fabs(offset.x), 2 * flock->maxBound - fabs(offset.x));
+		float y = fmin(fabs(offset.y), 2 * flock->maxBound - fabs(offset.y));
+		float z = fmin(fabs(offset.z), 2 * flock->maxBound - fabs(offset.z));
+		float divergence = Vector3(x, y, z).Length();
+
+		totalDivergence += divergence;
+		maxDivergence = fmax(maxDivergence, divergence);
 	}
 
-	glBufferData(GL_SHADER_STORAGE_BUFFER, numAgents * sizeof(Agent), flock->agents, GL_DYNAMIC_COPY);
+	std::cout << "Multi-rate rules (" << numAgents << " agents, " << steps << " steps, intervals " << intervals[0] << "/" << intervals[1] << "/" << intervals[2] << "):" << std::endl;
+	std::cout << "  every step: " << fullTime << "ms per step" << std::endl;
+	std::cout << "  multi-rate: " << multiTime << "ms per step, speedup " << fullTime / multiTime << std::endl;
+	std::cout << "  divergence: mean " << totalDivergence / numAgents << ", max " << maxDivergence << " (maxRadius " << flock->maxRadius << ")" << std::endl;
+
+	memcpy(flock->agents, start.data(), numAgents * sizeof(Agent));
+	cachedSums = startSums;
+	ruleStep = startStep;
+	alignmentInterval = intervals[0];
+	separationInterval = intervals[1];
+	cohesionInterval = intervals[2];
 }
 
-void SimulationCPU::FlockTree(Agent* a, Octree& tree, float dt) {
-	std::vector<Agent*> neighbours;
-	tree.GetNeighbours(a, flock->maxRadius, neighbours);
-	FlockBruteForce(a, neighbours, dt);
+void SimulationCPU::FlockTree(Agent* a, Octree& tree, CandidateBuffer& buffer, float dt) {
+	std::vector<int>& candidates = buffer.Begin();
+	tree.GetNeighbours(a->position, flock->maxRadius, candidates, false, buffer.MaxCount());
+	buffer.End();
+
+	NeighbourSums sums;
+	fovRejected += GatherNeighbours(a, candidates, sums);
+	ApplySums(a, sums, dt);
 }
 
-void SimulationCPU::FlockBruteForce(Agent* a, std::vector<Agent*> neighbours, float dt) {
-	Vector3 acceleration(0, 0, 0);
+void SimulationCPU::FlockBruteForce(Agent* a, const std::vector<Agent*>& neighbours, float dt) {
+	NeighbourSums sums;
+	fovRejected += GatherNeighbours(a, neighbours, sums);
+	ApplySums(a, sums, dt);
+}
 
-	acceleration += Steer(Alignment(a, neighbours), a->velocity) * flock->alignmentWeight;
-	acceleration += Steer(Separation(a, neighbours), a->velocity) * flock->separationWeight;
-	acceleration += Steer(Cohesion(a, neighbours), a->velocity) * flock->cohesionWeight;
-	acceleration += Steer(InteractWithRay(a), a->velocity) * flock->avoidanceWeight;
+void SimulationCPU::FlockGrid(float dt) {
+	auto start = std::chrono::high_resolution_clock::now();
+	grid.Build(flock->agents, numAgents, threadPool);
+	gridBuildTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 
-	a->position += a->velocity * dt;
-	a->velocity += acceleration;
-	a->velocity = Vector3::ClampMagnitude(a->velocity, flock->maxVelocity);
+	// Every agent gathers before any agent moves, so the update can run in parallel
+	threadPool->ParallelFor(numAgents, 1024, [&](int begin, int end) {
+		CandidateBuffer buffer;
+		int rejected = 0;
+
+		for (int i = begin; i < end; ++i) {
+			rejected += GatherGridNeighbours((*flock)[i], buffer, neighbourSums[i]);
+		}
+		fovRejected += rejected;
+	});
+
+	threadPool->ParallelFor(numAgents, 1024, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			ApplySums((*flock)[i], neighbourSums[i], dt);
+			neighbourSums[i] = NeighbourSums();
+		}
+	});
+}
 
-	a->position = WrapBounds(a->position);
+int SimulationCPU::GatherGridNeighbours(const Agent* a, CandidateBuffer& buffer, NeighbourSums& sums) {
+	std::vector<int>& candidates = buffer.Begin();
+	grid.GetNeighbours(a->position, candidates, buffer.MaxCount());
+	buffer.End();
+	return GatherNeighbours(a, candidates, sums);
 }
 
-void NCL::SimulationCPU::AvoidWalls(Agent* a, float dt) {
+// Only one of sliceCount z slabs of grid cells recomputes its steering each step, in rotation, while every
+// other agent keeps integrating the acceleration it last computed. sliceCount follows the measured cost per
+// steering update so that the recomputed slice fits in amortisedBudget milliseconds.
+void SimulationCPU::FlockAmortised(float dt) {
+	grid.Build(flock->agents, numAgents, threadPool);
 
-	float turningDist = 25;
-	float turningAngle = Maths::PI * 1.5f;
+	int slices = sliceCount;
+	int slice = currentSlice % slices;
+	int cellCount = grid.NumCells();
+	std::atomic<int> updated(0);
 
-	auto GetPerpVector = [](Vector3 v, Vector3 n)->Vector3 {
-		n.Normalise();
-		Vector3 temp = n * Vector3::Dot(v, n);
-		return (v - temp * 2);
-	};
+	auto start = std::chrono::high_resolution_clock::now();
+	threadPool->ParallelFor(numAgents, 1024, [&](int begin, int end) {
+		CandidateBuffer buffer;
+		int rejected = 0;
+		int count = 0;
+
+		for (int i = begin; i < end; ++i) {
+			Agent* a = (*flock)[i];
+			if ((int)((long long)a->cell * slices / cellCount) != slice) {
+				continue;
+			}
+			NeighbourSums sums;
+			rejected += GatherGridNeighbours(a, buffer, sums);
+			lastAcceleration[i] = SumsAcceleration(a, sums);
+			count++;
+		}
+		fovRejected += rejected;
+		updated += count;
+	});
+	float steeringTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 
-	Vector4 perpVec;
-	Vector4 newVel;
+	threadPool->ParallelFor(numAgents, 1024, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			Integrate((*flock)[i], lastAcceleration[i], dt);
+		}
+	});
 
-	float distTop = flock->maxBound - a->position.y;
-	float aTop = abs(acos(Vector3::Dot(Vector3(0, 1, 0), a->velocity.Normalised())));
-	if (aTop < turningAngle) {
-		perpVec = GetPerpVector(a->velocity, Vector3(0, 1, 0));
-		a->velocity += perpVec.Normalised() * Maths::Clamp((1 - (distTop / turningDist)), 0.0f, 1.0f);
+	if (updated > 0) {
+		float costPerAgent = steeringTime / updated;
+		steeringCostPerAgent = steeringCostPerAgent > 0 ? steeringCostPerAgent * 0.9f + costPerAgent * 0.1f : costPerAgent;
+	}
+	// Only a new rotation picks up a new slice count, so every slab is visited once per rotation
+	if (++currentSlice >= slices) {
+		currentSlice = 0;
+		int target = (int)ceil(steeringCostPerAgent * numAgents / settings.amortisedBudget);
+		sliceCount = target < 1 ? 1 : (target > maxSliceCount ? maxSliceCount : target);
 	}
+}
 
-	float distBottom = abs(-flock->maxBound - a->position.y);
-	float aBottom = abs(acos(Vector3::Dot(Vector3(0, -1, 0), a->velocity.Normalised())));
-	if (distBottom < turningDist && aBottom < turningAngle) {
-		perpVec = GetPerpVector(a->velocity, Vector3(0, -1, 0));
-		a->velocity += perpVec.Normalised() * Maths::Clamp((1 - (distBottom / turningDist)), 0.0f, 1.0f);
+// Near agents steer every step from all of their neighbours. Further tiers steer every lodInterval steps,
+// staggered by id, from an even sample of at most lodCap of their candidates, and integrate their last
+// acceleration in between. The cost then follows what the camera is looking at rather than the flock size.
+void SimulationCPU::FlockLod(float dt) {
+	UpdateLodTiers();
+	grid.Build(flock->agents, numAgents, threadPool);
+
+	threadPool->ParallelFor(numAgents, 1024, [&](int begin, int end) {
+		CandidateBuffer buffer;
+		int rejected = 0;
+
+		for (int i = begin; i < end; ++i) {
+			Agent* a = (*flock)[i];
+			int id = flock->AgentId(i);
+			int tier = lodTiers[id];
+			if (ruleStep > 1 && (ruleStep + id) % lodIntervals[tier] != 0) {
+				continue;
+			}
+
+			std::vector<int>& candidates = buffer.Begin();
+			grid.GetNeighbours(a->position, candidates, buffer.MaxCount());
+			buffer.End();
+
+			// Strided rather than truncated, as the grid lists candidates row by row
+			int cap = lodCaps[tier];
+			int count = (int)candidates.size();
+			if (cap > 0 && count > cap) {
+				for (int k = 0; k < cap; ++k) {
+					candidates[k] = candidates[(int)((long long)k * count / cap)];
+				}
+				candidates.resize(cap);
+			}
+
+			NeighbourSums sums;
+			rejected += GatherNeighbours(a, candidates, sums);
+			lastAcceleration[i] = SumsAcceleration(a, sums);
+		}
+		fovRejected += rejected;
+	});
+
+	threadPool->ParallelFor(numAgents, 1024, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			Integrate((*flock)[i], lastAcceleration[i], dt);
+		}
+	});
+}
+
+// The grid only holds the owned agents and the ghosts, and only the owned agents are stepped. Ghosts belong to
+// the neighbouring ranks, which step them with the same neighbours this rank sees and send them back next step.
+void SimulationCPU::FlockDomain(float dt) {
+	int owned = domain->OwnedCount();
+	grid.Build(flock->agents, domain->ActiveCount(), threadPool);
+
+	threadPool->ParallelFor(owned, 1024, [&](int begin, int end) {
+		CandidateBuffer buffer;
+		int rejected = 0;
+
+		for (int i = begin; i < end; ++i) {
+			Agent* a = (*flock)[i];
+			std::vector<int>& candidates = buffer.Begin();
+			grid.GetNeighbours(a->position, candidates, buffer.MaxCount());
+			buffer.End();
+
+			agentCosts[i] = (float)candidates.size() + 1;
+			rejected += GatherNeighbours(a, candidates, neighbourSums[i]);
+		}
+		fovRejected += rejected;
+	});
+
+	threadPool->ParallelFor(owned, 1024, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			ApplySums((*flock)[i], neighbourSums[i], dt);
+			neighbourSums[i] = NeighbourSums();
+		}
+	});
+}
+
+// An agent moves to a nearer tier once it is lodHysteresis inside that tier's distance, and to a further one
+// once it is lodHysteresis beyond it, so agents on a boundary don't flicker between tiers. Agents outside a
+// slightly widened view frustum are always far.
+void SimulationCPU::UpdateLodTiers() {
+	const float frustumMargin = 1.1f;
+	float thresholds[TierCount - 1] = { settings.lodNearDistance, (float)fmax(settings.lodNearDistance, settings.lodFarDistance) };
+	float promote = 1.0f - settings.lodHysteresis;
+	float demote = 1.0f + settings.lodHysteresis;
+
+	for (int t = 0; t < TierCount; ++t) {
+		lodTierCounts[t] = 0;
 	}
 
-	float distXFor = flock->maxBound - a->position.x;
-	float aXFor = abs(acos(Vector3::Dot(Vector3(1, 0, 0), a->velocity.Normalised())));
-	if (distXFor < turningDist) {
-		perpVec = GetPerpVector(a->velocity, Vector3(1, 0, 0));
-		a->velocity += perpVec.Normalised() * Maths::Clamp((1 - (distXFor / turningDist)), 0.0f, 1.0f);
+	threadPool->ParallelFor(numAgents, 4096, [&](int begin, int end) {
+		int counts[TierCount] = { 0, 0, 0 };
+
+		for (int i = begin; i < end; ++i) {
+			const Agent* a = (*flock)[i];
+			int id = flock->AgentId(i);
+
+			Vector4 clip = lodView.viewProjection * Vector4(a->position, 1.0f);
+			float extent = clip.w * frustumMargin;
+			bool visible = clip.w > 0 && fabs(clip.x) <= extent && fabs(clip.y) <= extent && fabs(clip.z) <= extent;
+
+			int tier = FarTier;
+			if (visible) {
+				float distance = (a->position - lodView.position).Length();
+				tier = lodTiers[id];
+				while (tier > NearTier && distance < thresholds[tier - 1] * promote) {
+					tier--;
+				}
+				while (tier < FarTier && distance > thresholds[tier] * demote) {
+					tier++;
+				}
+			}
+			lodTiers[id] = (unsigned char)tier;
+			counts[tier]++;
+		}
+		for (int t = 0; t < TierCount; ++t) {
+			lodTierCounts[t] += counts[t];
+		}
+	});
+}
+
+SimulationCPU::LodView SimulationCPU::CurrentLodView() const {
+	Camera* camera = renderer->GetCamera();
+	Vector2 dimensions = renderer->GetWindowDimensions();
+
+	LodView view;
+	view.position = camera->GetPosition();
+	view.viewProjection = camera->BuildProjectionMatrix(dimensions.x / dimensions.y) * camera->BuildViewMatrix();
+	return view;
+}
+
+// Every unordered pair of tiles is visited exactly once and both agents of a pair receive their
+// contribution, halving the distance tests. Tile pairs are scheduled as a round-robin tournament
+// so that no two pairs running in the same round share a tile, and the partial sums need no locks.
+void SimulationCPU::FlockTiled(float dt) {
+	int tileCount = (numAgents + tileSize - 1) / tileSize;
+
+	threadPool->ParallelFor(tileCount, 1, [&](int begin, int end) {
+		for (int t = begin; t < end; ++t) {
+			AccumulateTiles(t, t);
+		}
+	});
+
+	int paddedCount = tileCount + (tileCount & 1);
+	int pairsPerRound = paddedCount / 2;
+
+	for (int round = 0; round < paddedCount - 1; ++round) {
+		threadPool->ParallelFor(pairsPerRound, 1, [&](int begin, int end) {
+			for (int k = begin; k < end; ++k) {
+				int tileA = (k == 0) ? paddedCount - 1 : (round + k) % (paddedCount - 1);
+				int tileB = (round + paddedCount - 1 - k) % (paddedCount - 1);
+				if (tileA < tileCount && tileB < tileCount) {
+					AccumulateTiles(tileA, tileB);
+				}
+			}
+		});
 	}
 
-	float distXBack = abs(-flock->maxBound - a->position.x);
-	float aXBack = abs(acos(Vector3::Dot(Vector3(-1, 0, 0), a->velocity.Normalised())));
-	if (distXBack < turningDist) {
-		perpVec = GetPerpVector(a->velocity, Vector3(-1, 0, 0));
-		a->velocity += perpVec.Normalised() * Maths::Clamp((1 - (distXBack / turningDist)), 0.0f, 1.0f);
+	// Pairs are shared between two agents with different schedules, so tiles refresh every rule every step
+	threadPool->ParallelFor(numAgents, 1024, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			UseCachedRules(i, AllRules, neighbourSums[i]);
+			ApplySums(&flock->agents[i], neighbourSums[i], dt);
+			neighbourSums[i] = NeighbourSums();
+		}
+	});
+}
+
+void SimulationCPU::AccumulateTiles(int tileA, int tileB) {
+	int beginA = tileA * tileSize;
+	int endA = (int)fmin(beginA + tileSize, numAgents);
+	int beginB = tileB * tileSize;
+	int endB = (int)fmin(beginB + tileSize, numAgents);
+	int rejected = 0;
+
+	for (int i = beginA; i < endA; ++i) {
+		const Agent& a = flock->agents[i];
+		NeighbourSums& sumsA = neighbourSums[i];
+		float speedA = a.velocity.LengthSquared();
+
+		for (int j = (tileA == tileB) ? i + 1 : beginB; j < endB; ++j) {
+			const Agent& b = flock->agents[j];
+			Vector3 offset = a.position - b.position;
+			float distance = offset.LengthSquared();
+
+			if (distance > flock->maxRadiusSquared) {
+				continue;
+			}
+			NeighbourSums& sumsB = neighbourSums[j];
+
+			// The field of view is not symmetric, so each agent of the pair tests its own heading
+			float facingA = -Vector3::Dot(a.velocity, offset);
+			float facingB = Vector3::Dot(b.velocity, offset);
+			float lengthA = speedA * distance;
+			float lengthB = b.velocity.LengthSquared() * distance;
+
+			if (distance <= flock->alignmentRadiusSquared) {
+				bool seenByA = WithinView(facingA, lengthA, flock->alignmentViewThreshold);
+				bool seenByB = WithinView(facingB, lengthB, flock->alignmentViewThreshold);
+				if (seenByA) sumsA.alignment += b.velocity;
+				if (seenByB) sumsB.alignment += a.velocity;
+				rejected += !seenByA + !seenByB;
+			}
+			if (distance <= flock->separationRadiusSquared) {
+				Vector3 push = offset * (1.0f - (distance / flock->separationRadiusSquared));
+				bool seenByA = WithinView(facingA, lengthA, flock->separationViewThreshold);
+				bool seenByB = WithinView(facingB, lengthB, flock->separationViewThreshold);
+				if (seenByA) sumsA.separation += push;
+				if (seenByB) sumsB.separation -= push;
+				rejected += !seenByA + !seenByB;
+			}
+			if (distance <= flock->cohesionRadiusSquared) {
+				bool seenByA = WithinView(facingA, lengthA, flock->cohesionViewThreshold);
+				bool seenByB = WithinView(facingB, lengthB, flock->cohesionViewThreshold);
+				if (seenByA) {
+					sumsA.cohesion += b.position;
+					sumsA.cohesionCount++;
+				}
+				if (seenByB) {
+					sumsB.cohesion += a.position;
+					sumsB.cohesionCount++;
+				}
+				rejected += !seenByA + !seenByB;
+			}
+		}
 	}
+	fovRejected += rejected;
+}
+
+// Single pass over the candidates for all three rules, each with its own radius and field of view
+int SimulationCPU::GatherNeighbours(const Agent* a, const std::vector<int>& candidates, NeighbourSums& sums) {
+	int slot = (int)(a - flock->agents);
+	int rules = RulesDue(slot);
+	float speed = a->velocity.LengthSquared();
+	int rejected = 0;
 
-	float distZFor = flock->maxBound - a->position.z;
-	float aZFor = abs(acos(Vector3::Dot(Vector3(0, 0, 1), a->velocity.Normalised())));
-	if (distZFor < turningDist) {
-		perpVec = GetPerpVector(a->velocity, Vector3(0, 0, 1));
-		a->velocity += perpVec.Normalised() * Maths::Clamp((1 - (distZFor / turningDist)) * dt * 100, 0.0f, 1.0f);
+	for (int index : candidates) {
+		const Agent* neighbour = &flock->agents[index];
+		if (a != neighbour) {
+			rejected += AccumulateNeighbour(a, speed, *neighbour, sums, rules);
+		}
 	}
+	UseCachedRules(slot, rules, sums);
+	return rejected;
+}
 
-	float distZBack = abs(-flock->maxBound - a->position.z);
-	float aZBack = abs(acos(Vector3::Dot(Vector3(0, 0, -1), a->velocity.Normalised())));
-	if (distZBack < turningDist) {
-		perpVec = GetPerpVector(a->velocity, Vector3(0, 0, -1));
-		a->velocity += perpVec.Normalised() * Maths::Clamp((1 - (distZBack / turningDist)) * dt * 100, 0.0f, 1.0f);
+// Pointer based adapter over the same accumulation
+int SimulationCPU::GatherNeighbours(const Agent* a, const std::vector<Agent*>& neighbours, NeighbourSums& sums) {
+	int slot = (int)(a - flock->agents);
+	int rules = RulesDue(slot);
+	float speed = a->velocity.LengthSquared();
+	int rejected = 0;
+
+	for (const Agent* neighbour : neighbours) {
+		if (a != neighbour) {
+			rejected += AccumulateNeighbour(a, speed, *neighbour, sums, rules);
+		}
 	}
+	UseCachedRules(slot, rules, sums);
+	return rejected;
 }
 
-Vector3 NCL::SimulationCPU::InteractWithRay(Agent* a) {
-	bool attracting = Window::GetMouse()->ButtonDown(MouseButtons::RIGHT);
-	if (Window::GetMouse()->ButtonDown(MouseButtons::LEFT) || attracting) {
-		Camera* c = renderer->GetCamera();
-		Ray r = Ray(c->GetPosition(), Quaternion::EulerAnglesToQuaternion(c->GetPitch(), c->GetYaw(), 0) * Vector3(0, 0, -1));
+int SimulationCPU::RulesDue(int slot) const {
+	// The first step fills the cache for every agent
+	if (ruleStep <= 1) {
+		return AllRules;
+	}
+	// Ids rather than slots, so reordering the storage doesn't disturb the schedule
+	int phase = ruleStep + flock->AgentId(slot);
+	int rules = 0;
 
-		Vector3 avoidancePoint = r.ClosestPointOnRay(a->position);
+	rules |= phase % alignmentInterval == 0 ? AlignmentRule : 0;
+	rules |= phase % separationInterval == 0 ? SeparationRule : 0;
+	rules |= phase % cohesionInterval == 0 ? CohesionRule : 0;
+	return rules;
+}
 
-		float distance = (a->position - avoidancePoint).LengthSquared();
+// Rules gathered this step refresh the cache, the rest are filled in from it
+void SimulationCPU::UseCachedRules(int slot, int rules, NeighbourSums& sums) {
+	NeighbourSums& cached = cachedSums[slot];
 
-		if (distance < flock->avoidanceRadiusSquared) {
-			float strength = 1.0f - (distance / flock->avoidanceRadiusSquared);
-			return (a->position - avoidancePoint) * strength * (attracting ? 1 : -1);
+	if (rules & AlignmentRule) {
+		cached.alignment = sums.alignment;
+	}
+	else {
+		sums.alignment = cached.alignment;
+	}
+	if (rules & SeparationRule) {
+		cached.separation = sums.separation;
+	}
+	else {
+		sums.separation = cached.separation;
+	}
+	if (rules & CohesionRule) {
+		cached.cohesion = sums.cohesion;
+		cached.cohesionCount = sums.cohesionCount;
+	}
+	else {
+		sums.cohesion = cached.cohesion;
+		sums.cohesionCount = cached.cohesionCount;
+	}
+}
+
+int SimulationCPU::AccumulateNeighbour(const Agent* a, float speed, const Agent& neighbour, NeighbourSums& sums, int rules) {
+	Vector3 offset = a->position - neighbour.position;
+	float distance = offset.LengthSquared();
+
+	if (distance > flock->maxRadiusSquared) {
+		return 0;
+	}
+	float facing = -Vector3::Dot(a->velocity, offset);
+	float lengthProduct = speed * distance;
+	int rejected = 0;
+
+	if ((rules & AlignmentRule) && distance <= flock->alignmentRadiusSquared) {
+		if (WithinView(facing, lengthProduct, flock->alignmentViewThreshold)) {
+			sums.alignment += neighbour.velocity;
+		}
+		else {
+			rejected++;
+		}
+	}
+	if ((rules & SeparationRule) && distance <= flock->separationRadiusSquared) {
+		if (WithinView(facing, lengthProduct, flock->separationViewThreshold)) {
+			sums.separation += offset * (1.0f - (distance / flock->separationRadiusSquared));
+		}
+		else {
+			rejected++;
+		}
+	}
+	if ((rules & CohesionRule) && distance <= flock->cohesionRadiusSquared) {
+		if (WithinView(facing, lengthProduct, flock->cohesionViewThreshold)) {
+			sums.cohesion += neighbour.position;
+			sums.cohesionCount++;
+		}
+		else {
+			rejected++;
 		}
 	}
-	return Vector3(0, 0, 0);
+	return rejected;
 }
 
-Vector3 SimulationCPU::Steer(Vector3 desiredSteer, Vector3 velocity) {
-	Vector3 steer = desiredSteer.Normalised() * flock->maxVelocity - velocity;
-	steer = Vector3::ClampMagnitude(steer, flock->maxSteeringAngle);
-	return steer;
+void SimulationCPU::ApplySums(Agent* a, const NeighbourSums& sums, float dt) {
+	Integrate(a, SumsAcceleration(a, sums), dt);
+}
+
+Vector3 SimulationCPU::SumsAcceleration(const Agent* a, const NeighbourSums& sums) {
+	Vector3 cohesion = (a->position + sums.cohesion) / (float)(sums.cohesionCount + 1) - a->position;
+	return SteeringAcceleration(a, a->velocity + sums.alignment, a->velocity + sums.separation, cohesion);
 }
 
-bool NCL::SimulationCPU::WithinView(Agent* a, Agent* neighbour) {
-	float cosP = cos(Maths::DegreesToRadians(90));
+Vector3 SimulationCPU::SteeringAcceleration(const Agent* a, const Vector3& alignment, const Vector3& separation, const Vector3& cohesion) {
+	Vector3 acceleration(0, 0, 0);
+
+	acceleration += Steer(alignment, a->velocity) * flock->alignmentWeight;
+	acceleration += Steer(separation, a->velocity) * flock->separationWeight;
+	acceleration += Steer(cohesion, a->velocity) * flock->cohesionWeight;
+	acceleration += Steer(interactionField.Evaluate(a->position), a->velocity) * flock->avoidanceWeight;
+
+	float obstacleDistance;
+	Vector3 obstacleGradient;
+	if (obstacleField.Lookup(a->position, obstacleDistance, obstacleGradient) && obstacleDistance < flock->obstacleRange) {
+		float strength = Maths::Clamp(1.0f - (obstacleDistance / flock->obstacleRange), 0.0f, 1.0f);
+		acceleration += Steer(obstacleGradient, a->velocity) * flock->obstacleWeight * strength;
+	}
+
+	if (flock->boundaryMode == BoundaryMode::Contain) {
+		acceleration += ContainBounds(a->position);
+	}
+	return acceleration;
+}
 
-	float dx1 = a->velocity.x - a->position.x;
-	float dy1 = a->velocity.y - a->position.y;
-	float dz1 = a->velocity.z - a->position.z;
-	float dx2 = neighbour->position.x - a->position.x;
-	float dy2 = neighbour->position.y - a->position.y;
-	float dz2 = neighbour->position.z - a->position.z;
+void SimulationCPU::Integrate(Agent* a, const Vector3& acceleration, float dt) {
+	a->position += a->velocity * dt;
+	a->velocity += acceleration;
+	a->velocity = Vector3::ClampMagnitude(a->velocity, flock->maxVelocity);
 
-	float cosTheta = (dx1 * dx2 + dy1 * dy2 + dz1 * dz2) / (sqrt(dx1 * dx1 + dy1 * dy1 + dz1 * dz1) * sqrt(dx2 * dx2 + dy2 * dy2 + dz2 * dz2));
+	a->position = flock->boundaryMode == BoundaryMode::Wrap ? WrapBounds(a->position) : ClampBounds(a->position);
+}
 
-	return cosTheta < cosP;
+Vector3 SimulationCPU::Steer(Vector3 desiredSteer, Vector3 velocity) {
+	Vector3 steer = desiredSteer.Normalised() * flock->maxVelocity - velocity;
+	steer = Vector3::ClampMagnitude(steer, flock->maxSteeringAngle);
+	return steer;
 }
 
-Vector3& SimulationCPU::WrapBounds(Vector3 position) {
+Vector3 SimulationCPU::WrapBounds(Vector3 position) {
 	Vector3 newPos = position;
 
 	if (position.x < -flock->maxBound)
@@ -230,64 +1289,30 @@ Vector3& SimulationCPU::WrapBounds(Vector3 position) {
 	return newPos;
 }
 
-Vector3& SimulationCPU::Alignment(Agent* a, std::vector<Agent*> neighbours) {
-	Vector3 steering = a->velocity;
-
-	for (int i = 0; i < neighbours.size(); ++i) {
-		Agent* neighbour = neighbours[i];
-		if (a == neighbour) {
-			continue;
-		}
-		float distance = (a->position - neighbour->position).LengthSquared();
-
-		if (distance > flock->alignmentRadiusSquared) {
-			continue;
-		}
-		steering += neighbour->velocity;
+// Steers agents back inside the box once they enter the margin along a wall. Each axis ramps up quadratically
+// from zero at the inner edge of the margin to maxSteeringAngle at the wall, with only min/max and no branches.
+// A margin of 0 leaves nothing to ramp over, so the walls are just the clamp in Integrate.
+Vector3 SimulationCPU::ContainBounds(const Vector3& position) {
+	if (flock->containMargin <= 0.0f) {
+		return Vector3(0, 0, 0);
 	}
-	return steering;
-}
+	float inner = flock->maxBound - flock->containMargin;
+	float marginReciprocal = 1.0f / flock->containMargin;
 
-Vector3& SimulationCPU::Separation(Agent* a, std::vector<Agent*> neighbours) {
-	Vector3 steering = a->velocity;
+	float minX = fmin(fmax((-inner - position.x) * marginReciprocal, 0.0f), 1.0f);
+	float minY = fmin(fmax((-inner - position.y) * marginReciprocal, 0.0f), 1.0f);
+	float minZ = fmin(fmax((-inner - position.z) * marginReciprocal, 0.0f), 1.0f);
 
-	for (int i = 0; i < neighbours.size(); ++i) {
-		Agent* neighbour = neighbours[i];
-		if (a == neighbour) {
-			continue;
-		}
-		float distance = (a->position - neighbour->position).LengthSquared();
+	float maxX = fmin(fmax((position.x - inner) * marginReciprocal, 0.0f), 1.0f);
+	float maxY = fmin(fmax((position.y - inner) * marginReciprocal, 0.0f), 1.0f);
+	float maxZ = fmin(fmax((position.z - inner) * marginReciprocal, 0.0f), 1.0f);
 
-		if (distance > flock->separationRadiusSquared) {
-			continue;
-		}
-		float strength = 1.0f - (distance / flock->separationRadiusSquared);
-		steering += (a->position - neighbour->position) * strength;
-	}
-	return steering;
+	return Vector3(minX * minX - maxX * maxX, minY * minY - maxY * maxY, minZ * minZ - maxZ * maxZ) * flock->maxSteeringAngle;
 }
 
-Vector3& SimulationCPU::Cohesion(Agent* a, std::vector<Agent*> neighbours) {
-	Vector3 steering = a->position;
-	int neighbourCount = 1;
-
-	for (int i = 0; i < neighbours.size(); ++i) {
-		Agent* neighbour = neighbours[i];
-		if (a == neighbour) {
-			continue;
-		}
-		float distance = (a->position - neighbour->position).LengthSquared();
-
-		if (distance > flock->cohesionRadiusSquared) {
-			continue;
-		}
-		steering += neighbour->position;
-		neighbourCount++;
-	}
-
-	steering /= neighbourCount;
-	Vector3 vel = steering - a->position;
-	return vel;
+Vector3 SimulationCPU::ClampBounds(const Vector3& position) {
+	return Vector3(
+		fmin(fmax(position.x, -flock->maxBound), flock->maxBound),
+		fmin(fmax(position.y, -flock->maxBound), flock->maxBound),
+		fmin(fmax(position.z, -flock->maxBound), flock->maxBound));
 }
-
-
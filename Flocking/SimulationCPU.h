@@ -1,7 +1,19 @@
 #pragma once
 
 #include "Simulation.h"
+#include "CandidateBuffer.h"
+#include "DomainDecomposition.h"
+#include "FrameArena.h"
+#include "NumaPartitioner.h"
 #include "Octree.h"
+#include "RadixSort.h"
+#include "SharedFlockState.h"
+#include "TaskGraph.h"
+#include "TrajectoryRecorder.h"
+#include "TripleBuffer.h"
+#include "UniformGrid.h"
+#include <atomic>
+#include <thread>
 #include <vector>
 
 namespace NCL {
@@ -10,35 +22,192 @@ namespace NCL {
 	class SimulationCPU : public Simulation {
 	public:
 		SimulationCPU(bool useOctree, Simulation::Settings simSettings, FlockingRenderer* renderer);
-		~SimulationCPU() {};
+		~SimulationCPU();
 
 		void Update(float dt) override;
 
 	protected:
+		struct NeighbourSums {
+			Vector3 alignment;
+			Vector3 separation;
+			Vector3 cohesion;
+			int cohesionCount = 0;
+		};
+
+		// Where the camera is and what it sees, captured on the main thread for the step
+		struct LodView {
+			Vector3 position;
+			Matrix4 viewProjection;
+		};
+
+		enum LodTier {
+			NearTier,
+			MidTier,
+			FarTier,
+			TierCount
+		};
+
+		enum Rules {
+			AlignmentRule	= 1,
+			SeparationRule	= 2,
+			CohesionRule	= 4,
+			AllRules		= 7
+		};
+
+		// Everything the main thread hands to the simulation thread for a step
+		struct SimulationInput {
+			float alignmentWeight;
+			float separationWeight;
+			float cohesionWeight;
+			BoundaryMode boundaryMode;
+
+			bool paused;
+			bool useOctree;
+			bool useGrid;
+			bool useTiling;
+
+			LodView view;
+			std::vector<InteractionSource> sources;
+		};
 
 		void UpdateKeys(float dt) override;
 
+		// NUMA slabs are sorted by x and would be left holding restored agents they don't own
+		bool CanCheckpoint() const override {
+			return !asyncSimulation && !domain && !numa;
+		}
+		void WriteCheckpoint(CheckpointWriter& writer) override;
+		bool ReadCheckpoint(CheckpointReader& reader) override;
+
 		void PerformFlock(float dt) override;
+		void MaintainLocality();
+		void SwapSlotState(int slotA, int slotB);
+		uint32_t MortonCode(const Vector3& position) const;
+		void PerformFlockPipelined(float dt);
+		void PrepareStep(int slot, bool octree);
+		void StepAgents(Octree& tree, float dt, bool octree, bool gridSearch, bool tiled);
+		void StepAgentsNuma(Octree& tree, float dt);
+		void DrawFlockDebug(const Agent* agents, Octree* tree);
 
-		void FlockTree(Agent* a, Octree& tree, float dt);
-		void FlockBruteForce(Agent* b, std::vector<Agent*> neighbours, float dt);
+		void BenchmarkOctreeBuild();
+		void BenchmarkMultiRate();
 
-		void AvoidWalls(Agent* a, float dt);
-		Vector3 InteractWithRay(Agent* b);
+		void StartSimulationThread();
+		void SimulationLoop();
+		void PublishInput();
+		void PresentLatestSnapshot();
+		void PublishStep(const Agent* agents);
+		void RecordStep();
 
-		Vector3 Steer(Vector3 desiredSteer, Vector3 velocity);
-		bool WithinView(Agent* a, Agent* neighbour);
-		Vector3& WrapBounds(Vector3 position);
+		void FlockTree(Agent* a, Octree& tree, CandidateBuffer& buffer, float dt);
+		void FlockBruteForce(Agent* b, const std::vector<Agent*>& neighbours, float dt);
+		void FlockGrid(float dt);
+		void FlockAmortised(float dt);
+		void FlockLod(float dt);
+		void FlockDomain(float dt);
+		void UpdateLodTiers();
+		LodView CurrentLodView() const;
+		int GatherGridNeighbours(const Agent* a, CandidateBuffer& buffer, NeighbourSums& sums);
+		void FlockTiled(float dt);
+		void AccumulateTiles(int tileA, int tileB);
+		int GatherNeighbours(const Agent* a, const std::vector<int>& candidates, NeighbourSums& sums);
+		int GatherNeighbours(const Agent* a, const std::vector<Agent*>& neighbours, NeighbourSums& sums);
+		int AccumulateNeighbour(const Agent* a, float speed, const Agent& neighbour, NeighbourSums& sums, int rules);
+		int RulesDue(int slot) const;
+		void UseCachedRules(int slot, int rules, NeighbourSums& sums);
+		void ApplySums(Agent* a, const NeighbourSums& sums, float dt);
+		Vector3 SumsAcceleration(const Agent* a, const NeighbourSums& sums);
+		Vector3 SteeringAcceleration(const Agent* a, const Vector3& alignment, const Vector3& separation, const Vector3& cohesion);
+		void Integrate(Agent* a, const Vector3& acceleration, float dt);
 
-		Vector3& Alignment(Agent* a, std::vector<Agent*> neighbours);
-		Vector3& Separation(Agent* a, std::vector<Agent*> neighbours);
-		Vector3& Cohesion(Agent* a, std::vector<Agent*> neighbours);
+		Vector3 Steer(Vector3 desiredSteer, Vector3 velocity);
+		Vector3 WrapBounds(Vector3 position);
+		Vector3 ContainBounds(const Vector3& position);
+		Vector3 ClampBounds(const Vector3& position);
 
 		bool showOctree;
 		bool useOctree;
+		bool useTiling;
+		bool useGrid;
+
+		UniformGrid grid;
+		std::atomic<float> gridBuildTime;
+
+		// Amortised mode, enabled by a non-zero amortisedBudget
+		static const int maxSliceCount = 64;
+		std::atomic<int> sliceCount;
+		int currentSlice;
+		float steeringCostPerAgent;
+		std::vector<Vector3> lastAcceleration;
+
+		// Level of detail mode, enabled by a non-zero lodNearDistance. Tiers are kept by agent id.
+		LodView lodView;
+		std::vector<unsigned char> lodTiers;
+		int lodIntervals[TierCount];
+		int lodCaps[TierCount];
+		std::atomic<int> lodTierCounts[TierCount];
+
+		// Z order reordering of the agent storage
+		RadixSort radixSort;
+		std::vector<uint32_t> mortonKeys;
+		std::vector<int> reorderOrder;
+		// Scratch the per slot state is gathered into on a reorder, then swapped with, so it is only allocated once
+		std::vector<Vector3> reorderAcceleration;
+		std::vector<NeighbourSums> reorderSums;
+		int stepsSinceReorder;
+		float localityDisorder;
+
+		int tileSize;
+		std::vector<NeighbourSums> neighbourSums;
+
+		// Each rule refreshes its sums every interval steps, staggered across agents by their ids,
+		// and steers from the sums cached at its last refresh in between
+		int alignmentInterval;
+		int separationInterval;
+		int cohesionInterval;
+		int ruleStep;
+		std::vector<NeighbourSums> cachedSums;
 
 		int octreeMaxDepth;
 		int octreeMaxSize;
+
+		// With a depth of 2, step N + 1 runs on the workers while step N is uploaded and drawn from its snapshot
+		int pipelineDepth;
+		int stepSlot;
+		bool stepsLaunched;
+		TaskGraph* frameGraph;
+		std::vector<Agent*> snapshots;
+		std::vector<Octree*> snapshotTrees;
+
+		// State from before each snapshot's last step, for the renderer to blend from
+		std::vector<Agent*> previousSnapshots;
+
+		// Transients of the step in each slot, such as its octree, reset every time the slot steps
+		std::vector<FrameArena*> frameArenas;
+
+		// With async simulation the flock is stepped on its own thread at simulationRate steps per second,
+		// or as fast as it can when the rate is 0, and the renderer draws whichever snapshot is newest
+		bool asyncSimulation;
+		std::atomic<bool> simulationRunning;
+		std::thread simulationThread;
+		TripleBuffer<SimulationInput> inputs;
+		TripleBuffer<std::vector<Agent>> publishedAgents;
+
+		// Only created in NUMA aware mode, where it owns the agent storage
+		NumaPartitioner* numa;
+
+		// Only created with more than one domain, where this process steps its own slab of the world
+		DomainDecomposition* domain;
+
+		// What each slot cost to step last time, as candidates tested plus one, for balancing partitions
+		std::vector<float> agentCosts;
+
+		// Only created with a sharedStateName, and written by whichever thread finishes a step
+		SharedFlockState* sharedState;
+		uint64_t stepCount;
+
+		// Only created with a trajectoryFile, and like sharedState written by whichever thread finishes a step
+		TrajectoryRecorder* trajectory;
 	};
 }
 
@@ -1,7 +1,6 @@
 #include "SimulationGPU.h"
 #include "Debug.h"
 #include "Flock.h"
-#include "../Common/Quaternion.h"
 #include "../Common/Camera.h"
 #include "../Plugins/OpenGLRendering/OGLComputeShader.h"
 
@@ -12,6 +11,7 @@ SimulationGPU::SimulationGPU(bool useGrid, Simulation::Settings simSettings, Flo
 	this->showGrid = false;
 
 	gridVisualisationRange = 8000;
+	bufObstacles = 0;
 
 	InitFlock();
 
@@ -20,6 +20,8 @@ SimulationGPU::SimulationGPU(bool useGrid, Simulation::Settings simSettings, Flo
 
 	InitFlockComputer();
 	InitGrid();
+	InitObstacles();
+	InitCounters();
 
 	Debug::SetRenderer(renderer);
 	renderer->InitFlock(bufFlock, numAgents, settings.maxBound, settings.modelScale);
@@ -28,6 +30,8 @@ SimulationGPU::SimulationGPU(bool useGrid, Simulation::Settings simSettings, Flo
 SimulationGPU::~SimulationGPU() {
 	glDeleteBuffers(1, &bufFlock);
 	glDeleteBuffers(1, &bufGridInd);
+	glDeleteBuffers(1, &bufObstacles);
+	glDeleteBuffers(1, &bufCounters);
 
 	delete bruteForceComputer;
 	delete gridComputer;
@@ -41,11 +45,15 @@ void SimulationGPU::Update(float dt) {
 
 	UpdateStats(dt);
 	UpdateKeys(dt);
+	UpdateInteractionField();
 
 	PerformFlock(dt);
 
 	DrawUIText();
 	renderer->DrawBoundingBox(drawBox ? flock->maxBound : 0);
+	if (drawBox) {
+		obstacleField.DebugDraw();
+	}
 	Debug::FlushRenderables(dt);
 	renderer->Render();
 }
@@ -67,13 +75,48 @@ void SimulationGPU::UpdateKeys(float dt) {
 	}
 }
 
+// The agents only live on the GPU, so the host copy is refreshed before it is saved
+void NCL::SimulationGPU::WriteCheckpoint(CheckpointWriter& writer) {
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufFlock);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, numAgents * sizeof(Agent), flock->agents);
+
+	Simulation::WriteCheckpoint(writer);
+}
+
 void NCL::SimulationGPU::PerformFlock(float dt) {
-	if (!paused && useGrid) {
-		FlockGrid(dt);
-		BitonicSort();
+	int steps = paused ? 0 : ConsumeSteps(dt);
+
+	// Reading the counter back forces a sync, so only do it when there is something to report
+	bool countRejections = steps > 0 && flock->HasLimitedView();
+	GLuint zero = 0;
+
+	if (countRejections) {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufCounters);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &zero);
+	}
+
+	for (int i = 0; i < steps; ++i) {
+		// Sorting before the step rather than after keeps the saved state in the same order as the result
+		if (useGrid) {
+			BitonicSort();
+		}
+		if (i == steps - 1 && BlendsSteps()) {
+			SavePreviousState();
+		}
+		if (useGrid) {
+			FlockGrid(StepDuration(dt));
+		}
+		else {
+			FlockBruteForce(StepDuration(dt));
+		}
 	}
-	else if (!paused) {
-		FlockBruteForce(dt);
+	renderer->SetInterpolation(InterpolationFactor());
+
+	if (countRejections) {
+		GLuint rejected = 0;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufCounters);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &rejected);
+		fovRejected = (int)rejected;
 	}
 
 	if (useGrid && showGrid) {
@@ -145,6 +188,45 @@ void NCL::SimulationGPU::InitGrid() {
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, bufGridInd);
 }
 
+void NCL::SimulationGPU::InitObstacles() {
+	int resolution = obstacleField.IsEmpty() ? 0 : obstacleField.GetResolution();
+
+	for (OGLComputeShader* computer : { bruteForceComputer, gridComputer }) {
+		computer->Bind();
+		glUniform1i(glGetUniformLocation(computer->GetProgramID(), "obstacleResolution"), resolution);
+		glUniform1f(glGetUniformLocation(computer->GetProgramID(), "obstacleRange"), flock->obstacleRange);
+		glUniform1f(glGetUniformLocation(computer->GetProgramID(), "obstacleWeight"), flock->obstacleWeight);
+	}
+
+	if (resolution == 0) {
+		return;
+	}
+	const std::vector<ObstacleField::FieldSample>& samples = obstacleField.GetSamples();
+
+	glGenBuffers(1, &bufObstacles);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufObstacles);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, samples.size() * sizeof(ObstacleField::FieldSample), samples.data(), GL_STATIC_DRAW);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, bufObstacles);
+}
+
+// A full circle of view is sent as -2 rather than -1, which every neighbour passes whatever the rounding
+// of its dot product, so the shaders need no separate test for it
+void NCL::SimulationGPU::InitCounters() {
+	auto shaderThreshold = [](float threshold) {
+		return threshold <= -1.0f ? -2.0f : threshold;
+	};
+	for (OGLComputeShader* computer : { bruteForceComputer, gridComputer }) {
+		computer->Bind();
+		glUniform3f(glGetUniformLocation(computer->GetProgramID(), "viewThresholds"), shaderThreshold(flock->alignmentViewThreshold),
+			shaderThreshold(flock->separationViewThreshold), shaderThreshold(flock->cohesionViewThreshold));
+	}
+
+	glGenBuffers(1, &bufCounters);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufCounters);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, bufCounters);
+}
+
 // Adapted from: https://github.com/vojtatom/flocking-cpp/blob/master/src/glcontext.cpp
 void NCL::SimulationGPU::BitonicSort() {
 	flockSorter->Bind();
@@ -186,6 +268,8 @@ void NCL::SimulationGPU::FlockBruteForce(float dt) {
 
 	glUniform1f(glGetUniformLocation(bruteForceComputer->GetProgramID(), "dt"), dt);
 	glUniform4f(glGetUniformLocation(bruteForceComputer->GetProgramID(), "weights"), flock->alignmentWeight, flock->separationWeight, flock->cohesionWeight, flock->avoidanceWeight);
+	glUniform1i(glGetUniformLocation(bruteForceComputer->GetProgramID(), "boundaryMode"), flock->boundaryMode == BoundaryMode::Contain ? 1 : 0);
+	glUniform1f(glGetUniformLocation(bruteForceComputer->GetProgramID(), "containMargin"), flock->containMargin);
 
 	bruteForceComputer->Execute(workGroups, 1, 1);
 	glMemoryBarrier(GL_ALL_BARRIER_BITS);
@@ -200,6 +284,8 @@ void NCL::SimulationGPU::FlockGrid(float dt) {
 
 	glUniform1f(glGetUniformLocation(gridComputer->GetProgramID(), "dt"), dt);
 	glUniform4f(glGetUniformLocation(gridComputer->GetProgramID(), "weights"), flock->alignmentWeight, flock->separationWeight, flock->cohesionWeight, flock->avoidanceWeight);
+	glUniform1i(glGetUniformLocation(gridComputer->GetProgramID(), "boundaryMode"), flock->boundaryMode == BoundaryMode::Contain ? 1 : 0);
+	glUniform1f(glGetUniformLocation(gridComputer->GetProgramID(), "containMargin"), flock->containMargin);
 
 	gridComputer->Execute(workGroups, 1, 1);
 	glMemoryBarrier(GL_ALL_BARRIER_BITS);
@@ -207,18 +293,18 @@ void NCL::SimulationGPU::FlockGrid(float dt) {
 	gridComputer->Unbind();
 }
 
-void NCL::SimulationGPU::CastAvoidanceRay() {
-	bool attracting = Window::GetMouse()->ButtonDown(MouseButtons::RIGHT);
-	if (Window::GetMouse()->ButtonDown(MouseButtons::LEFT) || attracting) {
-		Camera* c = renderer->GetCamera();
-		Ray r = Ray(c->GetPosition(), Quaternion::EulerAnglesToQuaternion(c->GetPitch(), c->GetYaw(), 0) * Vector3(0, 0, -1));
-
-		Vector3 lineStart = r.GetPosition();
-		Vector3 lineEnd = r.GetPosition() + r.GetDirection().Normalised() * 100000;
+void NCL::SimulationGPU::SavePreviousState() {
+	glBindBuffer(GL_COPY_READ_BUFFER, bufFlock);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, bufFlockPrevious);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, numAgents * sizeof(Agent));
+}
 
-		glUniform3fv(glGetUniformLocation(bruteForceComputer->GetProgramID(), "avLineStart"), 1, (float*)&lineStart);
-		glUniform3fv(glGetUniformLocation(bruteForceComputer->GetProgramID(), "avLineEnd"), 1, (float*)&lineEnd);
-		glUniform1i(glGetUniformLocation(bruteForceComputer->GetProgramID(), "mouseState"), attracting ? 1 : 2);
+// The compute shaders only take the mouse ray; scripted sources are evaluated on the CPU path
+void NCL::SimulationGPU::CastAvoidanceRay() {
+	if (mouseRayActive) {
+		glUniform3fv(glGetUniformLocation(bruteForceComputer->GetProgramID(), "avLineStart"), 1, (float*)&mouseRay.start);
+		glUniform3fv(glGetUniformLocation(bruteForceComputer->GetProgramID(), "avLineEnd"), 1, (float*)&mouseRay.end);
+		glUniform1i(glGetUniformLocation(bruteForceComputer->GetProgramID(), "mouseState"), mouseRay.strength > 0 ? 1 : 2);
 	}
 	else {
 		glUniform1i(glGetUniformLocation(bruteForceComputer->GetProgramID(), "mouseState"), 0);
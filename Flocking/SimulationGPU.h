@@ -17,14 +17,19 @@ namespace NCL {
 
 		void UpdateKeys(float dt) override;
 
+		void WriteCheckpoint(CheckpointWriter& writer) override;
+
 		void PerformFlock(float dt) override;
 
 		void DrawGrid();
 
 		void InitFlockComputer();
 		void InitGrid();
+		void InitObstacles();
+		void InitCounters();
 
 		void BitonicSort();
+		void SavePreviousState();
 
 		void FlockBruteForce(float dt);
 		void FlockGrid(float dt);
@@ -38,6 +43,8 @@ namespace NCL {
 		OGLComputeShader* gridIndexer = nullptr;
 
 		GLuint bufGridInd;
+		GLuint bufObstacles;
+		GLuint bufCounters;
 
 		int invocations;
 		int workGroups;
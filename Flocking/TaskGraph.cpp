@@ -0,0 +1,70 @@
+#include "TaskGraph.h"
+
+using namespace NCL;
+
+TaskGraph::TaskGraph(ThreadPool* pool) {
+	this->pool = pool;
+	running = false;
+}
+
+TaskGraph::~TaskGraph() {
+	Wait();
+}
+
+int TaskGraph::AddTask(std::function<void()> job, const std::vector<int>& dependencies) {
+	int id = (int)nodes.size();
+	nodes.emplace_back();
+
+	Node& node = nodes.back();
+	node.job = std::move(job);
+	node.dependencyCount = (int)dependencies.size();
+
+	for (int dependency : dependencies) {
+		nodes[dependency].dependents.push_back(id);
+	}
+	return id;
+}
+
+void TaskGraph::Clear() {
+	Wait();
+	nodes.clear();
+}
+
+void TaskGraph::Launch() {
+	Wait();
+	running = true;
+
+	for (Node& node : nodes) {
+		node.remaining = node.dependencyCount;
+	}
+	// Roots are collected first, as a pool without workers runs each task (and its dependents) inline
+	std::vector<int> roots;
+	for (int i = 0; i < (int)nodes.size(); ++i) {
+		if (nodes[i].dependencyCount == 0) {
+			roots.push_back(i);
+		}
+	}
+	for (int root : roots) {
+		Schedule(root);
+	}
+}
+
+void TaskGraph::Wait() {
+	if (running) {
+		pool->Wait(group);
+		running = false;
+	}
+}
+
+void TaskGraph::Schedule(int task) {
+	pool->Run(group, [this, task]() {
+		Node& node = nodes[task];
+		node.job();
+
+		for (int dependent : node.dependents) {
+			if (nodes[dependent].remaining.fetch_sub(1) == 1) {
+				Schedule(dependent);
+			}
+		}
+	});
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "ThreadPool.h"
+#include <deque>
+#include <functional>
+#include <vector>
+
+namespace NCL {
+	// A small dependency graph of jobs run on a ThreadPool. Tasks are added with the ids of the tasks they
+	// depend on, the graph is launched, and each task is queued as soon as its last dependency finishes.
+	// The launching thread is free to do other work until it calls Wait.
+	class TaskGraph {
+	public:
+		TaskGraph(ThreadPool* pool);
+		~TaskGraph();
+
+		// Only valid while the graph is not running
+		int AddTask(std::function<void()> job, const std::vector<int>& dependencies = {});
+		void Clear();
+
+		void Launch();
+		void Wait();
+
+		bool IsRunning() const {
+			return running;
+		}
+
+	protected:
+		struct Node {
+			Node() : remaining(0) {}
+
+			std::function<void()> job;
+			std::vector<int> dependents;
+			int dependencyCount = 0;
+			std::atomic<int> remaining;
+		};
+
+		void Schedule(int task);
+
+		ThreadPool* pool;
+		ThreadPool::TaskGroup group;
+
+		std::deque<Node> nodes;
+		bool running;
+	};
+}
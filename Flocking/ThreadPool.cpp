@@ -0,0 +1,117 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+using namespace NCL;
+
+namespace {
+	thread_local int threadIndex = 0;
+}
+
+ThreadPool::ThreadPool(int numThreads, std::function<void(int index)> workerStart) {
+	shuttingDown = false;
+	this->workerStart = workerStart;
+
+	if (numThreads <= 0) {
+		numThreads = (int)std::thread::hardware_concurrency();
+	}
+	for (int i = 1; i < numThreads; ++i) {
+		workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		shuttingDown = true;
+	}
+	queueCondition.notify_all();
+
+	for (std::thread& t : workers) {
+		t.join();
+	}
+}
+
+int ThreadPool::ThreadIndex() {
+	return threadIndex;
+}
+
+void ThreadPool::Run(TaskGroup& group, std::function<void()> task) {
+	group.pending.fetch_add(1);
+
+	if (workers.empty()) {
+		task();
+		group.pending.fetch_sub(1);
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		tasks.push_back({ std::move(task), &group });
+	}
+	queueCondition.notify_one();
+}
+
+void ThreadPool::Wait(TaskGroup& group) {
+	// The waiting thread keeps executing queued work so nested task groups can't starve the pool
+	while (group.pending.load() > 0) {
+		if (!RunPendingTask()) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+void ThreadPool::ParallelFor(int count, int grainSize, const std::function<void(int begin, int end)>& job) {
+	if (count <= 0) {
+		return;
+	}
+	grainSize = std::max(grainSize, 1);
+
+	if (count <= grainSize || workers.empty()) {
+		job(0, count);
+		return;
+	}
+
+	TaskGroup group;
+	for (int begin = 0; begin < count; begin += grainSize) {
+		int end = std::min(begin + grainSize, count);
+		Run(group, [&job, begin, end]() { job(begin, end); });
+	}
+	Wait(group);
+}
+
+void ThreadPool::WorkerLoop(int index) {
+	threadIndex = index;
+	if (workerStart) {
+		workerStart(index);
+	}
+
+	while (true) {
+		Task task;
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			queueCondition.wait(lock, [this]() { return shuttingDown || !tasks.empty(); });
+
+			if (tasks.empty()) {
+				return;
+			}
+			task = std::move(tasks.front());
+			tasks.pop_front();
+		}
+		task.job();
+		task.group->pending.fetch_sub(1);
+	}
+}
+
+bool ThreadPool::RunPendingTask() {
+	Task task;
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		if (tasks.empty()) {
+			return false;
+		}
+		task = std::move(tasks.front());
+		tasks.pop_front();
+	}
+	task.job();
+	task.group->pending.fetch_sub(1);
+	return true;
+}
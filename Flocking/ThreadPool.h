@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace NCL {
+	class ThreadPool {
+	public:
+		struct TaskGroup {
+			TaskGroup() : pending(0) {}
+			std::atomic<int> pending;
+		};
+
+		// workerStart runs on each worker, with its index, before it takes any work
+		ThreadPool(int numThreads = 0, std::function<void(int index)> workerStart = nullptr);
+		~ThreadPool();
+
+		// Number of threads that execute work, including the calling thread
+		int NumThreads() const {
+			return (int)workers.size() + 1;
+		}
+
+		// 0 for the thread that owns the pool, 1..n for workers
+		static int ThreadIndex();
+
+		void Run(TaskGroup& group, std::function<void()> task);
+		void Wait(TaskGroup& group);
+
+		// Splits [0, count) into chunks of at most grainSize and blocks until every chunk has run
+		void ParallelFor(int count, int grainSize, const std::function<void(int begin, int end)>& job);
+
+	protected:
+		struct Task {
+			std::function<void()> job;
+			TaskGroup* group;
+		};
+
+		void WorkerLoop(int index);
+		bool RunPendingTask();
+
+		std::function<void(int index)> workerStart;
+		std::vector<std::thread> workers;
+		std::deque<Task> tasks;
+
+		std::mutex queueMutex;
+		std::condition_variable queueCondition;
+		bool shuttingDown;
+	};
+}
@@ -0,0 +1,252 @@
+#include "TrajectoryCodec.h"
+#include <cmath>
+#include <cstring>
+
+using namespace NCL;
+
+namespace {
+	// rANS with a 32 bit state renormalised a byte at a time, and symbol frequencies out of 2^12
+	const int scaleBits = 12;
+	const uint32_t scaleTotal = 1u << scaleBits;
+	const uint32_t ransLow = 1u << 23;
+
+	inline uint32_t ZigZag(int32_t v) {
+		return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+	}
+
+	inline int32_t UnZigZag(uint32_t v) {
+		return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+	}
+
+	inline void PutVarint(std::vector<uint8_t>& out, uint32_t v) {
+		while (v >= 0x80) {
+			out.push_back((uint8_t)(v | 0x80));
+			v >>= 7;
+		}
+		out.push_back((uint8_t)v);
+	}
+
+	inline bool GetVarint(const uint8_t*& in, const uint8_t* end, uint32_t& v) {
+		v = 0;
+		for (int shift = 0; shift < 35; shift += 7) {
+			if (in == end) {
+				return false;
+			}
+			uint8_t byte = *in++;
+			v |= (uint32_t)(byte & 0x7f) << shift;
+			if (byte < 0x80) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Scales byte counts to frequencies summing to scaleTotal, keeping every byte that occurs above 0
+	void NormaliseFrequencies(const uint32_t* counts, size_t total, uint16_t* frequencies) {
+		uint32_t sum = 0;
+		for (int s = 0; s < 256; ++s) {
+			frequencies[s] = counts[s] == 0 ? 0 : (uint16_t)std::fmax(1.0, (double)counts[s] * scaleTotal / total);
+			sum += frequencies[s];
+		}
+		// Rounding leaves the sum a little off, which the most frequent bytes absorb best
+		while (sum != scaleTotal) {
+			int largest = 0;
+			for (int s = 1; s < 256; ++s) {
+				if (frequencies[s] > frequencies[largest]) {
+					largest = s;
+				}
+			}
+			if (sum < scaleTotal) {
+				frequencies[largest] += (uint16_t)(scaleTotal - sum);
+				sum = scaleTotal;
+			}
+			else {
+				uint32_t take = sum - scaleTotal < frequencies[largest] / 2u ? sum - scaleTotal : frequencies[largest] / 2u;
+				take = take > 0 ? take : 1;
+				frequencies[largest] -= (uint16_t)take;
+				sum -= take;
+			}
+		}
+	}
+
+	template <typename T>
+	void Append(std::vector<char>& out, const T& value) {
+		const char* bytes = (const char*)&value;
+		out.insert(out.end(), bytes, bytes + sizeof(T));
+	}
+}
+
+TrajectoryCodec::TrajectoryCodec(int numAgents, float maxBound, float maxVelocity, int bits) {
+	this->numAgents = numAgents;
+	this->maxBound = maxBound;
+	this->maxVelocity = maxVelocity;
+
+	bits = bits < 1 ? 1 : (bits > 24 ? 24 : bits);
+	maxValue = (1 << bits) - 1;
+	positionScale = maxValue / (2 * maxBound);
+	velocityScale = maxValue / (2 * maxVelocity);
+}
+
+void TrajectoryCodec::Quantise(const Agent* agents, const int* slots, int32_t* frame) const {
+	QuantiseFrame(agents, slots, frame);
+}
+
+void TrajectoryCodec::Quantise(const Agent* agents, const int* slots, uint16_t* frame) const {
+	QuantiseFrame(agents, slots, frame);
+}
+
+template <typename T>
+void TrajectoryCodec::QuantiseFrame(const Agent* agents, const int* slots, T* frame) const {
+	for (int id = 0; id < numAgents; ++id) {
+		const Agent& agent = agents[slots[id]];
+		T* values = frame + id * channels;
+		for (int axis = 0; axis < 3; ++axis) {
+			float position = ((&agent.position.x)[axis] + maxBound) * positionScale;
+			float velocity = ((&agent.velocity.x)[axis] + maxVelocity) * velocityScale;
+			values[axis] = (T)std::fmax(0.0f, std::fmin((float)maxValue, std::round(position)));
+			values[3 + axis] = (T)std::fmax(0.0f, std::fmin((float)maxValue, std::round(velocity)));
+		}
+	}
+}
+
+void TrajectoryCodec::Dequantise(const int32_t* frame, TrajectorySample* samples) const {
+	for (int id = 0; id < numAgents; ++id) {
+		const int32_t* values = frame + id * channels;
+		for (int axis = 0; axis < 3; ++axis) {
+			(&samples[id].position.x)[axis] = values[axis] / positionScale - maxBound;
+			(&samples[id].velocity.x)[axis] = values[3 + axis] / velocityScale - maxVelocity;
+		}
+	}
+}
+
+void TrajectoryCodec::EncodeBlock(const int32_t* frames, int frameCount, std::vector<char>& encoded) const {
+	EncodeFrames(frames, frameCount, encoded);
+}
+
+void TrajectoryCodec::EncodeBlock(const uint16_t* frames, int frameCount, std::vector<char>& encoded) const {
+	EncodeFrames(frames, frameCount, encoded);
+}
+
+// Layout: raw size | 256 frequencies | payload size | payload. Predictions are made in 32 bits whatever T is.
+template <typename T>
+void TrajectoryCodec::EncodeFrames(const T* frames, int frameCount, std::vector<char>& encoded) const {
+	int frameValues = FrameValues();
+
+	std::vector<uint8_t> residuals;
+	residuals.reserve((size_t)frameCount * frameValues * 2);
+	for (int f = 0; f < frameCount; ++f) {
+		const T* frame = frames + (size_t)f * frameValues;
+		const T* previous = f > 0 ? frame - frameValues : nullptr;
+		const T* beforePrevious = f > 1 ? previous - frameValues : nullptr;
+		for (int i = 0; i < frameValues; ++i) {
+			int32_t predicted = f == 0 ? 0 : (f == 1 ? (int32_t)previous[i] : 2 * (int32_t)previous[i] - (int32_t)beforePrevious[i]);
+			PutVarint(residuals, ZigZag((int32_t)frame[i] - predicted));
+		}
+	}
+
+	uint32_t counts[256] = {};
+	for (uint8_t byte : residuals) {
+		counts[byte]++;
+	}
+	uint16_t frequencies[256] = {};
+	uint32_t starts[256] = {};
+	if (!residuals.empty()) {
+		NormaliseFrequencies(counts, residuals.size(), frequencies);
+	}
+	for (int s = 1; s < 256; ++s) {
+		starts[s] = starts[s - 1] + frequencies[s - 1];
+	}
+
+	// rANS encodes backwards, so the decoder can read forwards. No byte costs more than scaleBits bits.
+	std::vector<uint8_t> payload(residuals.size() * 2 + 16);
+	uint8_t* end = payload.data() + payload.size();
+	uint8_t* out = end;
+	uint32_t state = ransLow;
+	for (size_t i = residuals.size(); i-- > 0;) {
+		uint8_t symbol = residuals[i];
+		uint32_t frequency = frequencies[symbol];
+		uint32_t limit = ((ransLow >> scaleBits) << 8) * frequency;
+		while (state >= limit) {
+			*--out = (uint8_t)state;
+			state >>= 8;
+		}
+		state = ((state / frequency) << scaleBits) + state % frequency + starts[symbol];
+	}
+	out -= 4;
+	for (int b = 0; b < 4; ++b) {
+		out[b] = (uint8_t)(state >> (8 * b));
+	}
+
+	encoded.clear();
+	Append(encoded, (uint32_t)residuals.size());
+	encoded.insert(encoded.end(), (const char*)frequencies, (const char*)frequencies + sizeof(frequencies));
+	Append(encoded, (uint32_t)(end - out));
+	encoded.insert(encoded.end(), (const char*)out, (const char*)end);
+}
+
+bool TrajectoryCodec::DecodeBlock(const char* encoded, size_t bytes, int frameCount, int32_t* frames) const {
+	uint32_t rawBytes = 0;
+	uint16_t frequencies[256];
+	uint32_t payloadBytes = 0;
+	size_t headerBytes = sizeof(rawBytes) + sizeof(frequencies) + sizeof(payloadBytes);
+	if (bytes < headerBytes) {
+		return false;
+	}
+	memcpy(&rawBytes, encoded, sizeof(rawBytes));
+	memcpy(frequencies, encoded + sizeof(rawBytes), sizeof(frequencies));
+	memcpy(&payloadBytes, encoded + sizeof(rawBytes) + sizeof(frequencies), sizeof(payloadBytes));
+	if (payloadBytes < 4 || headerBytes + payloadBytes > bytes) {
+		return false;
+	}
+
+	uint32_t starts[256];
+	uint32_t sum = 0;
+	for (int s = 0; s < 256; ++s) {
+		starts[s] = sum;
+		sum += frequencies[s];
+	}
+	if (rawBytes > 0 && sum != scaleTotal) {
+		return false;
+	}
+	uint8_t symbols[scaleTotal];
+	for (int s = 0; s < 256 && rawBytes > 0; ++s) {
+		memset(symbols + starts[s], s, frequencies[s]);
+	}
+
+	const uint8_t* in = (const uint8_t*)encoded + headerBytes;
+	const uint8_t* inEnd = in + payloadBytes;
+	uint32_t state = in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+	in += 4;
+
+	std::vector<uint8_t> residuals(rawBytes);
+	for (uint32_t i = 0; i < rawBytes; ++i) {
+		uint32_t slot = state & (scaleTotal - 1);
+		uint8_t symbol = symbols[slot];
+		residuals[i] = symbol;
+		state = frequencies[symbol] * (state >> scaleBits) + slot - starts[symbol];
+		while (state < ransLow) {
+			if (in == inEnd) {
+				return false;
+			}
+			state = (state << 8) | *in++;
+		}
+	}
+
+	int frameValues = FrameValues();
+	const uint8_t* residual = residuals.data();
+	const uint8_t* residualEnd = residual + residuals.size();
+	for (int f = 0; f < frameCount; ++f) {
+		int32_t* frame = frames + (size_t)f * frameValues;
+		const int32_t* previous = f > 0 ? frame - frameValues : nullptr;
+		const int32_t* beforePrevious = f > 1 ? previous - frameValues : nullptr;
+		for (int i = 0; i < frameValues; ++i) {
+			uint32_t value;
+			if (!GetVarint(residual, residualEnd, value)) {
+				return false;
+			}
+			int32_t predicted = f == 0 ? 0 : (f == 1 ? previous[i] : 2 * previous[i] - beforePrevious[i]);
+			frame[i] = predicted + UnZigZag(value);
+		}
+	}
+	return residual == residualEnd;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "Agent.h"
+#include <cstdint>
+#include <vector>
+
+namespace NCL {
+	struct TrajectorySample {
+		Vector3 position;
+		Vector3 velocity;
+	};
+
+	// Compresses blocks of trajectory frames. Positions are quantised to 2^bits steps across the bound and
+	// velocities to 2^bits steps across +-maxVelocity. The first frame of a block is stored whole and the
+	// rest as the difference from a linear prediction off the frames before, which for agents moving
+	// smoothly is close to 0. The residuals are packed as variable length integers and then entropy coded
+	// with rANS, so each block decodes on its own.
+	class TrajectoryCodec {
+	public:
+		// Quantised values per agent: position xyz, then velocity xyz
+		static const int channels = 6;
+
+		TrajectoryCodec(int numAgents, float maxBound, float maxVelocity, int bits);
+
+		// slots maps each agent id to where it is in agents, and frame is written in id order. Values of up
+		// to 16 bits can be kept in half the memory, and encode the same either way.
+		void Quantise(const Agent* agents, const int* slots, int32_t* frame) const;
+		void Quantise(const Agent* agents, const int* slots, uint16_t* frame) const;
+		void Dequantise(const int32_t* frame, TrajectorySample* samples) const;
+
+		// frames holds frameCount quantised frames one after another
+		void EncodeBlock(const int32_t* frames, int frameCount, std::vector<char>& encoded) const;
+		void EncodeBlock(const uint16_t* frames, int frameCount, std::vector<char>& encoded) const;
+		// Returns false if the block is damaged or doesn't hold frameCount frames
+		bool DecodeBlock(const char* encoded, size_t bytes, int frameCount, int32_t* frames) const;
+
+		int FrameValues() const {
+			return numAgents * channels;
+		}
+
+	protected:
+		template <typename T>
+		void QuantiseFrame(const Agent* agents, const int* slots, T* frame) const;
+		template <typename T>
+		void EncodeFrames(const T* frames, int frameCount, std::vector<char>& encoded) const;
+
+		int numAgents;
+		float maxBound;
+		float maxVelocity;
+		int32_t maxValue;
+		float positionScale;
+		float velocityScale;
+	};
+}
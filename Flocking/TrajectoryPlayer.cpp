@@ -0,0 +1,127 @@
+#include "TrajectoryPlayer.h"
+#include "../Common/Window.h"
+#include <chrono>
+#include <cmath>
+
+using namespace NCL;
+
+namespace {
+	// The rate the simulation steps at by default, which the frames are replayed at
+	const float stepsPerSecond = 60.0f;
+}
+
+TrajectoryPlayer::TrajectoryPlayer(const std::string& filename, FlockingRenderer* renderer) {
+	this->filename = filename;
+	this->renderer = renderer;
+	bufFlock = 0;
+	bufFlockPrevious = 0;
+	position = 0;
+	paused = false;
+	loadedFrame = -1;
+	lastDecodeTime = 0;
+	drawBox = true;
+
+	reader = TrajectoryReader::Open(filename);
+	framesPerSecond = reader ? stepsPerSecond / reader->Interval() : 0;
+	if (!reader) {
+		return;
+	}
+	agents.resize(reader->NumAgents());
+
+	glGenBuffers(1, &bufFlock);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, bufFlock);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, reader->NumAgents() * sizeof(Agent), nullptr, GL_DYNAMIC_COPY);
+
+	glGenBuffers(1, &bufFlockPrevious);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, bufFlockPrevious);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, reader->NumAgents() * sizeof(Agent), nullptr, GL_DYNAMIC_COPY);
+
+	renderer->InitFlock(bufFlock, 0, reader->MaxBound());
+}
+
+TrajectoryPlayer::~TrajectoryPlayer() {
+	if (reader) {
+		glDeleteBuffers(1, &bufFlock);
+		glDeleteBuffers(1, &bufFlockPrevious);
+	}
+	delete reader;
+}
+
+// Copies the samples read last into buffer
+void TrajectoryPlayer::Upload(GLuint buffer) {
+	for (size_t i = 0; i < samples.size(); ++i) {
+		agents[i].position = samples[i].position;
+		agents[i].velocity = samples[i].velocity;
+		agents[i].cell = 0;
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, agents.size() * sizeof(Agent), agents.data());
+}
+
+// The frame goes in the previous agents binding and the one after it in the current, so the renderer can blend
+bool TrajectoryPlayer::LoadFrames(int frame) {
+	auto start = std::chrono::high_resolution_clock::now();
+
+	int next = frame + 1 < reader->FrameCount() ? frame + 1 : frame;
+	if (!reader->ReadFrame(frame, samples)) {
+		return false;
+	}
+	Upload(bufFlockPrevious);
+	if (!reader->ReadFrame(next, samples)) {
+		return false;
+	}
+	Upload(bufFlock);
+
+	auto end = std::chrono::high_resolution_clock::now();
+	lastDecodeTime = std::chrono::duration<float, std::milli>(end - start).count();
+	loadedFrame = frame;
+	return true;
+}
+
+void TrajectoryPlayer::Update(float dt) {
+	renderer->UpdateCamera(dt);
+
+	if (Window::GetKeyboard()->KeyPressed(KeyboardKeys::B)) {
+		drawBox = !drawBox;
+	}
+
+	if (!reader || reader->FrameCount() == 0) {
+		renderer->DrawString("Can't replay " + filename, Vector2(1, 2), Vector4(0.5f, 0.3f, 0.8f, 1), 10.0f);
+		renderer->Render();
+		return;
+	}
+
+	if (Window::GetKeyboard()->KeyPressed(KeyboardKeys::SPACE)) {
+		paused = !paused;
+		position = std::floor(position);
+	}
+	if (Window::GetKeyboard()->KeyPressed(KeyboardKeys::HOME)) {
+		position = 0;
+	}
+	if (paused && Window::GetKeyboard()->KeyPressed(KeyboardKeys::RIGHT)) {
+		position += 1;
+	}
+	if (paused && Window::GetKeyboard()->KeyPressed(KeyboardKeys::LEFT)) {
+		position -= 1;
+	}
+	if (!paused) {
+		position += dt * framesPerSecond;
+	}
+	// Playback stops on the last frame, which has nothing after it to blend towards
+	float lastFrame = (float)(reader->FrameCount() - 1);
+	position = position < 0 ? 0 : (position > lastFrame ? lastFrame : position);
+
+	int frame = (int)position;
+	if (frame != loadedFrame && LoadFrames(frame)) {
+		renderer->SetAgentCount(reader->NumAgents());
+	}
+	renderer->SetInterpolation(position - frame);
+
+	renderer->DrawString("Replaying " + filename + ", frame " + std::to_string(frame + 1) + " of " + std::to_string(reader->FrameCount()) +
+		", step " + std::to_string(reader->FrameStep(frame)) + (paused ? " (paused)" : ""),
+		Vector2(1, 2), Vector4(0.5f, 0.3f, 0.8f, 1), 10.0f);
+	renderer->DrawString("Frame Decode: " + std::to_string(lastDecodeTime) + " ms",
+		Vector2(1, 6), Vector4(0.5f, 0.3f, 0.8f, 1), 10.0f);
+	renderer->DrawBoundingBox(drawBox ? reader->MaxBound() : 0);
+	renderer->Render();
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "FlockingRenderer.h"
+#include "TrajectoryReader.h"
+
+namespace NCL {
+	// Plays back a recorded trajectory through the renderer, blending between neighbouring frames. Space
+	// pauses, the arrow keys step a frame either way while paused, and Home goes back to the start. Any
+	// frame can be jumped to, so only the block holding it is decoded.
+	class TrajectoryPlayer {
+	public:
+		TrajectoryPlayer(const std::string& filename, FlockingRenderer* renderer);
+		~TrajectoryPlayer();
+
+		void Update(float dt);
+
+	protected:
+		bool LoadFrames(int frame);
+		void Upload(GLuint buffer);
+
+		std::string filename;
+		FlockingRenderer* renderer;
+		TrajectoryReader* reader;
+
+		GLuint bufFlock;
+		GLuint bufFlockPrevious;
+		std::vector<TrajectorySample> samples;
+		std::vector<Agent> agents;
+
+		// In frames, with the fraction blending towards the next one
+		float position;
+		float framesPerSecond;
+		bool paused;
+		int loadedFrame;
+		float lastDecodeTime;
+		bool drawBox;
+	};
+}
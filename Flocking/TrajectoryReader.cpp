@@ -0,0 +1,94 @@
+#include "TrajectoryReader.h"
+#include <iostream>
+
+using namespace NCL;
+
+TrajectoryReader::TrajectoryReader(FILE* file) {
+	this->file = file;
+	header = {};
+	codec = nullptr;
+	cachedBlock = -1;
+}
+
+TrajectoryReader::~TrajectoryReader() {
+	fclose(file);
+	delete codec;
+}
+
+TrajectoryReader* TrajectoryReader::Open(const std::string& filename) {
+	FILE* file = fopen(filename.c_str(), "rb");
+	if (!file) {
+		std::cout << "Can't open trajectory " << filename << std::endl;
+		return nullptr;
+	}
+	TrajectoryReader* reader = new TrajectoryReader(file);
+	if (!reader->ReadIndex()) {
+		std::cout << "Trajectory " << filename << " is from another version, or was never closed" << std::endl;
+		delete reader;
+		return nullptr;
+	}
+	return reader;
+}
+
+bool TrajectoryReader::ReadAt(uint64_t offset, void* data, size_t bytes) {
+#ifdef _WIN32
+	bool found = _fseeki64(file, (long long)offset, SEEK_SET) == 0;
+#else
+	bool found = fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+	return found && fread(data, 1, bytes, file) == bytes;
+}
+
+// Frames sharing an offset were compressed into the same block, which ends where the next block starts
+bool TrajectoryReader::ReadIndex() {
+	if (!ReadAt(0, &header, sizeof(header)) || header.magic != TrajectoryRecorder::fileMagic || header.version != TrajectoryRecorder::fileVersion || header.indexOffset == 0) {
+		return false;
+	}
+	index.resize(header.frameCount);
+	if (!ReadAt(header.indexOffset, index.data(), index.size() * sizeof(TrajectoryRecorder::IndexEntry))) {
+		return false;
+	}
+	if (header.bits == 0) {
+		return true;
+	}
+
+	codec = new TrajectoryCodec(header.numAgents, header.maxBound, header.maxVelocity, header.bits);
+	frameBlocks.resize(index.size());
+	for (int frame = 0; frame < (int)index.size(); ++frame) {
+		if (blocks.empty() || blocks.back().offset != index[frame].offset) {
+			blocks.push_back({ index[frame].offset, 0, frame, 0 });
+		}
+		blocks.back().frameCount++;
+		frameBlocks[frame] = (int)blocks.size() - 1;
+	}
+	for (size_t i = 0; i < blocks.size(); ++i) {
+		uint64_t end = i + 1 < blocks.size() ? blocks[i + 1].offset : header.indexOffset;
+		blocks[i].bytes = (size_t)(end - blocks[i].offset);
+	}
+	return true;
+}
+
+bool TrajectoryReader::ReadFrame(int frame, std::vector<TrajectorySample>& samples) {
+	if (frame < 0 || frame >= (int)index.size()) {
+		return false;
+	}
+	samples.resize(header.numAgents);
+
+	if (!codec) {
+		return ReadAt(index[frame].offset + sizeof(TrajectoryRecorder::FrameHeader), samples.data(), samples.size() * sizeof(TrajectorySample));
+	}
+
+	int blockIndex = frameBlocks[frame];
+	const Block& block = blocks[blockIndex];
+	if (blockIndex != cachedBlock) {
+		cachedBlock = -1;
+		encoded.resize(block.bytes);
+		cachedFrames.resize((size_t)block.frameCount * codec->FrameValues());
+		if (!ReadAt(block.offset, encoded.data(), encoded.size()) || !codec->DecodeBlock(encoded.data(), encoded.size(), block.frameCount, cachedFrames.data())) {
+			return false;
+		}
+		cachedBlock = blockIndex;
+	}
+	codec->Dequantise(cachedFrames.data() + (size_t)(frame - block.firstFrame) * codec->FrameValues(), samples.data());
+	return true;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "TrajectoryRecorder.h"
+#include <cstdio>
+
+namespace NCL {
+	// Reads back a trajectory that a TrajectoryRecorder has closed. Any frame can be read directly: a raw
+	// frame is one read, and a compressed one decodes the block it is in, which is kept for the frames after.
+	class TrajectoryReader {
+	public:
+		// Returns nullptr if the file isn't a finished trajectory
+		static TrajectoryReader* Open(const std::string& filename);
+		~TrajectoryReader();
+
+		int NumAgents() const {
+			return header.numAgents;
+		}
+
+		float MaxBound() const {
+			return header.maxBound;
+		}
+
+		// Steps between recorded frames
+		int Interval() const {
+			return header.interval;
+		}
+
+		int FrameCount() const {
+			return (int)index.size();
+		}
+
+		uint64_t FrameStep(int frame) const {
+			return index[frame].step;
+		}
+
+		// Fills samples with the frame in agent id order
+		bool ReadFrame(int frame, std::vector<TrajectorySample>& samples);
+
+	protected:
+		struct Block {
+			uint64_t offset;
+			size_t bytes;
+			int firstFrame;
+			int frameCount;
+		};
+
+		TrajectoryReader(FILE* file);
+
+		bool ReadIndex();
+		bool ReadAt(uint64_t offset, void* data, size_t bytes);
+
+		FILE* file;
+		TrajectoryRecorder::Header header;
+		std::vector<TrajectoryRecorder::IndexEntry> index;
+
+		// Only used for compressed trajectories
+		TrajectoryCodec* codec;
+		std::vector<Block> blocks;
+		std::vector<int> frameBlocks;
+		int cachedBlock;
+		std::vector<int32_t> cachedFrames;
+		std::vector<char> encoded;
+	};
+}
@@ -0,0 +1,492 @@
+#include "TrajectoryRecorder.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace NCL;
+
+namespace {
+	// Extents start on a boundary every platform can map from, and the header has the first one to itself
+	const uint64_t extentAlignment = 64 * 1024;
+	// Extents hold whole frames, about this much of them, so mapping and flushing aren't per frame
+	const size_t targetExtentBytes = 64 * 1024 * 1024;
+
+	// Blocks beyond the encoder count let recording carry on while every encoder is busy
+	const int spareBlocks = 2;
+	// What all the blocks' quantised frames together may take
+	const size_t blockBudget = (size_t)1024 * 1024 * 1024;
+
+	// The index written so far is appended after every extent, or every this many blocks, once at least
+	// indexSpacing times its own size has been written since the last one, which bounds the dead space it leaves
+	const int indexBlocks = 16;
+	const int indexSpacing = 8;
+}
+
+TrajectoryRecorder::TrajectoryRecorder(const std::string& filename, int numAgents, float maxBound, float maxVelocity, int interval, int bits, int blockFrames) {
+	this->filename = filename;
+	this->numAgents = numAgents;
+	this->maxBound = maxBound;
+	this->maxVelocity = maxVelocity;
+	this->interval = interval > 0 ? interval : 1;
+	this->bits = bits > 0 ? std::min(bits, 24) : 0;
+	this->blockFrames = blockFrames > 0 ? blockFrames : 1;
+
+	// Encoding is given a quarter of the machine, leaving the rest to the simulation, as long as its blocks fit the budget
+	encoderCount = std::max(1, (int)std::thread::hardware_concurrency() / 4);
+	if (this->bits > 0) {
+		size_t frameValueBytes = (size_t)numAgents * TrajectoryCodec::channels * (this->bits <= 16 ? sizeof(uint16_t) : sizeof(int32_t));
+		size_t blockBytes = std::max((size_t)1, this->blockFrames * frameValueBytes);
+		encoderCount = std::max(1, std::min(encoderCount, (int)(blockBudget / blockBytes) - spareBlocks));
+		int fittingFrames = std::max(1, (int)(blockBudget / ((encoderCount + spareBlocks) * std::max((size_t)1, frameValueBytes))));
+		if (fittingFrames < this->blockFrames) {
+			std::cout << "Trajectory blocks cut to " << fittingFrames << " frames to fit in " << blockBudget / (1024 * 1024) << "MB" << std::endl;
+			this->blockFrames = fittingFrames;
+		}
+	}
+
+	frameBytes = sizeof(FrameHeader) + numAgents * sizeof(TrajectorySample);
+	size_t framesPerExtent = frameBytes < targetExtentBytes ? targetExtentBytes / frameBytes : 1;
+	extentBytes = (size_t)((framesPerExtent * frameBytes + extentAlignment - 1) / extentAlignment * extentAlignment);
+
+	file = -1;
+	nextReady = false;
+	mapFailed = false;
+	running = false;
+	nextOffset = extentAlignment;
+	framesRecorded = 0;
+	framesDropped = 0;
+
+	filling = nullptr;
+	blocksSubmitted = 0;
+	blocksWritten = 0;
+	fileEnd = sizeof(Header);
+	codec = nullptr;
+	encoders = nullptr;
+}
+
+TrajectoryRecorder* TrajectoryRecorder::Create(const std::string& filename, int numAgents, float maxBound, float maxVelocity, int interval, int bits, int blockFrames) {
+	TrajectoryRecorder* recorder = new TrajectoryRecorder(filename, numAgents, maxBound, maxVelocity, interval, bits, blockFrames);
+	if (!recorder->Open()) {
+		std::cout << "Can't record trajectories to " << filename << std::endl;
+		delete recorder;
+		return nullptr;
+	}
+	return recorder;
+}
+
+TrajectoryRecorder::~TrajectoryRecorder() {
+	if (running) {
+		// Whatever has been recorded of the last block is still written
+		if (filling && !filling->steps.empty()) {
+			SubmitBlock();
+		}
+		if (encoders) {
+			encoders->Wait(encoding);
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+			if (current.memory) {
+				retired.push_back(current);
+			}
+		}
+		wake.notify_one();
+		flushThread.join();
+		if (next.memory) {
+			UnmapExtent(next, false);
+		}
+
+		// The index goes straight after the last frame, and the preallocated space past it is given back
+		uint64_t end = codec ? fileEnd : (index.empty() ? extentAlignment : index.back().offset + frameBytes);
+		bool written = WriteIndex(index, end) && Truncate(end + index.size() * sizeof(IndexEntry));
+		if (!written) {
+			std::cout << "Trajectory " << filename << " has no frame index" << std::endl;
+		}
+	}
+
+#ifdef _WIN32
+	if (file != -1) {
+		CloseHandle((HANDLE)file);
+	}
+#else
+	if (file != -1) {
+		close((int)file);
+	}
+#endif
+
+	delete encoders;
+	delete codec;
+	for (Block* block : blocks) {
+		delete block;
+	}
+}
+
+bool TrajectoryRecorder::Open() {
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	file = (intptr_t)handle;
+#else
+	int descriptor = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (descriptor < 0) {
+		return false;
+	}
+	file = descriptor;
+#endif
+
+	// Marked unfinished until the index is written
+	Header header = MakeHeader();
+	if (!WriteAt(0, &header, sizeof(Header))) {
+		return false;
+	}
+
+	if (bits > 0) {
+		codec = new TrajectoryCodec(numAgents, maxBound, maxVelocity, bits);
+		encoders = new ThreadPool(encoderCount + 1);
+		for (int i = 0; i < encoderCount + spareBlocks; ++i) {
+			blocks.push_back(new Block());
+		}
+		freeBlocks = blocks;
+
+		running = true;
+		flushThread = std::thread(&TrajectoryRecorder::WriteLoop, this);
+		return true;
+	}
+
+	current = MapExtent(nextOffset);
+	if (!current.memory) {
+		return false;
+	}
+	nextOffset += extentBytes;
+
+	running = true;
+	flushThread = std::thread(&TrajectoryRecorder::FlushLoop, this);
+	return true;
+}
+
+TrajectoryRecorder::Header TrajectoryRecorder::MakeHeader() const {
+	Header header = {};
+	header.magic = fileMagic;
+	header.version = fileVersion;
+	header.numAgents = numAgents;
+	header.interval = interval;
+	header.maxBound = maxBound;
+	header.maxVelocity = maxVelocity;
+	header.bits = bits;
+	header.blockFrames = blockFrames;
+	return header;
+}
+
+bool TrajectoryRecorder::WriteAt(uint64_t offset, const void* data, size_t bytes) {
+#ifdef _WIN32
+	OVERLAPPED position = {};
+	position.Offset = (DWORD)offset;
+	position.OffsetHigh = (DWORD)(offset >> 32);
+	DWORD written = 0;
+	return WriteFile((HANDLE)file, data, (DWORD)bytes, &written, &position) && written == bytes;
+#else
+	const char* source = (const char*)data;
+	while (bytes > 0) {
+		ssize_t written = pwrite((int)file, source, bytes, offset);
+		if (written <= 0) {
+			return false;
+		}
+		source += written;
+		offset += written;
+		bytes -= written;
+	}
+	return true;
+#endif
+}
+
+bool TrajectoryRecorder::WriteIndex(const std::vector<IndexEntry>& entries, uint64_t offset) {
+	Header header = MakeHeader();
+	header.frameCount = entries.size();
+	header.indexOffset = offset;
+	return WriteAt(offset, entries.data(), entries.size() * sizeof(IndexEntry)) && WriteAt(0, &header, sizeof(Header));
+}
+
+bool TrajectoryRecorder::Truncate(uint64_t bytes) {
+#ifdef _WIN32
+	LARGE_INTEGER size;
+	size.QuadPart = (LONGLONG)bytes;
+	return SetFilePointerEx((HANDLE)file, size, nullptr, FILE_BEGIN) && SetEndOfFile((HANDLE)file);
+#else
+	return ftruncate((int)file, bytes) == 0;
+#endif
+}
+
+// Allocates the disk space up front, so writing into the mapping later can't fail
+TrajectoryRecorder::Extent TrajectoryRecorder::MapExtent(uint64_t offset) {
+	Extent extent;
+	extent.offset = offset;
+#ifdef _WIN32
+	uint64_t end = offset + extentBytes;
+	HANDLE mapping = CreateFileMappingA((HANDLE)file, nullptr, PAGE_READWRITE, (DWORD)(end >> 32), (DWORD)end, nullptr);
+	if (!mapping) {
+		return extent;
+	}
+	extent.memory = (char*)MapViewOfFile(mapping, FILE_MAP_WRITE, (DWORD)(offset >> 32), (DWORD)offset, extentBytes);
+	if (!extent.memory) {
+		CloseHandle(mapping);
+		return extent;
+	}
+	extent.mapping = (intptr_t)mapping;
+#else
+#ifdef __linux__
+	if (posix_fallocate((int)file, offset, extentBytes) != 0) {
+		return extent;
+	}
+#else
+	if (ftruncate((int)file, offset + extentBytes) != 0) {
+		return extent;
+	}
+#endif
+	void* memory = mmap(nullptr, extentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, (int)file, offset);
+	extent.memory = memory == MAP_FAILED ? nullptr : (char*)memory;
+#endif
+
+	// Faulting the pages in here keeps the faults off whoever records into them
+	if (extent.memory) {
+		for (size_t page = 0; page < extentBytes; page += 4096) {
+			extent.memory[page] = 0;
+		}
+	}
+	return extent;
+}
+
+void TrajectoryRecorder::UnmapExtent(Extent& extent, bool flush) {
+	if (!extent.memory) {
+		return;
+	}
+#ifdef _WIN32
+	if (flush && extent.used > 0) {
+		FlushViewOfFile(extent.memory, extent.used);
+	}
+	UnmapViewOfFile(extent.memory);
+	CloseHandle((HANDLE)extent.mapping);
+#else
+	if (flush && extent.used > 0) {
+		msync(extent.memory, extent.used, MS_SYNC);
+	}
+	munmap(extent.memory, extentBytes);
+#endif
+	extent.memory = nullptr;
+}
+
+// Runs on whichever thread finishes a step. The copy only touches memory; switching to the next
+// extent just swaps pointers, and if the flush thread hasn't mapped it yet the frame is skipped.
+void TrajectoryRecorder::Record(const Agent* agents, const int* slots, uint64_t step) {
+	if (step % interval != 0) {
+		return;
+	}
+	if (codec) {
+		RecordBlock(agents, slots, step);
+		return;
+	}
+	if (!current.memory || current.used + frameBytes > extentBytes) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!nextReady) {
+				framesDropped++;
+				return;
+			}
+			if (current.memory) {
+				retired.push_back(current);
+			}
+			current = next;
+			next = Extent();
+			nextReady = false;
+		}
+		wake.notify_one();
+	}
+	if (!current.memory) {
+		framesDropped++;
+		return;
+	}
+
+	char* frame = current.memory + current.used;
+	FrameHeader header = {};
+	header.step = step;
+	header.count = numAgents;
+	memcpy(frame, &header, sizeof(FrameHeader));
+
+	TrajectorySample* samples = (TrajectorySample*)(frame + sizeof(FrameHeader));
+	for (int id = 0; id < numAgents; ++id) {
+		const Agent& agent = agents[slots[id]];
+		samples[id].position = agent.position;
+		samples[id].velocity = agent.velocity;
+	}
+
+	index.push_back({ step, current.offset + current.used });
+	current.used += frameBytes;
+	framesRecorded++;
+}
+
+// The flush thread keeps its own index of the frames it has flushed, read back from their frame headers,
+// and writes it past the extents mapped so far, which the next extent then starts after
+void TrajectoryRecorder::FlushLoop() {
+	std::vector<IndexEntry> flushed;
+	uint64_t bytesSinceIndex = 0;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		wake.wait(lock, [this]() {
+			return !retired.empty() || !nextReady || !running;
+		});
+		std::vector<Extent> flushing;
+		flushing.swap(retired);
+		bool map = !nextReady && running;
+		bool stopping = !running;
+		lock.unlock();
+
+		// The recorder may already be waiting on the next extent, so it is mapped before anything is flushed
+		if (map) {
+			Extent mapped = MapExtent(nextOffset);
+			if (mapped.memory) {
+				nextOffset += extentBytes;
+			}
+
+			lock.lock();
+			// A failed extent is handed over anyway, so each frame that finds it skipped asks for another
+			if (!mapped.memory && !mapFailed) {
+				std::cout << "Can't extend trajectory " << filename << ", skipping frames" << std::endl;
+			}
+			mapFailed = !mapped.memory;
+			next = mapped;
+			nextReady = true;
+			lock.unlock();
+		}
+		for (Extent& extent : flushing) {
+			for (size_t frame = 0; frame < extent.used; frame += frameBytes) {
+				FrameHeader header;
+				memcpy(&header, extent.memory + frame, sizeof(FrameHeader));
+				flushed.push_back({ header.step, extent.offset + frame });
+			}
+			bytesSinceIndex += extent.used;
+			UnmapExtent(extent, true);
+		}
+
+		uint64_t indexBytes = flushed.size() * sizeof(IndexEntry);
+		if (!stopping && !flushing.empty() && bytesSinceIndex >= indexSpacing * indexBytes && WriteIndex(flushed, nextOffset)) {
+			nextOffset += (indexBytes + extentAlignment - 1) / extentAlignment * extentAlignment;
+			bytesSinceIndex = 0;
+		}
+
+		lock.lock();
+		if (stopping) {
+			break;
+		}
+	}
+}
+
+// Quantising is all the recording thread does. Block storage is only allocated once a block is first used.
+void TrajectoryRecorder::RecordBlock(const Agent* agents, const int* slots, uint64_t step) {
+	if (!filling) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (freeBlocks.empty()) {
+			framesDropped++;
+			return;
+		}
+		filling = freeBlocks.back();
+		freeBlocks.pop_back();
+	}
+	size_t frameOffset = filling->steps.size() * codec->FrameValues();
+	if (bits <= 16) {
+		filling->narrowFrames.resize((size_t)blockFrames * codec->FrameValues());
+		codec->Quantise(agents, slots, filling->narrowFrames.data() + frameOffset);
+	}
+	else {
+		filling->frames.resize((size_t)blockFrames * codec->FrameValues());
+		codec->Quantise(agents, slots, filling->frames.data() + frameOffset);
+	}
+	filling->steps.push_back(step);
+	framesRecorded++;
+
+	if ((int)filling->steps.size() == blockFrames) {
+		SubmitBlock();
+	}
+}
+
+void TrajectoryRecorder::SubmitBlock() {
+	Block* block = filling;
+	filling = nullptr;
+	block->number = blocksSubmitted++;
+
+	encoders->Run(encoding, [this, block]() {
+		if (bits <= 16) {
+			codec->EncodeBlock(block->narrowFrames.data(), (int)block->steps.size(), block->encoded);
+		}
+		else {
+			codec->EncodeBlock(block->frames.data(), (int)block->steps.size(), block->encoded);
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			encodedBlocks[block->number] = block;
+		}
+		wake.notify_one();
+	});
+}
+
+// Encoders finish out of order, so each block waits here until the ones before it have been written
+void TrajectoryRecorder::WriteLoop() {
+	bool failed = false;
+	int blocksSinceIndex = 0;
+	uint64_t bytesSinceIndex = 0;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		wake.wait(lock, [this]() {
+			return encodedBlocks.count(blocksWritten) > 0 || !running;
+		});
+		auto encoded = encodedBlocks.find(blocksWritten);
+		if (encoded == encodedBlocks.end()) {
+			// Stopping only happens once every block has been encoded
+			break;
+		}
+		Block* block = encoded->second;
+		encodedBlocks.erase(encoded);
+		lock.unlock();
+
+		if (WriteAt(fileEnd, block->encoded.data(), block->encoded.size())) {
+			for (uint64_t step : block->steps) {
+				index.push_back({ step, fileEnd });
+			}
+			fileEnd += block->encoded.size();
+			blocksSinceIndex++;
+			bytesSinceIndex += block->encoded.size();
+		}
+		else {
+			if (!failed) {
+				std::cout << "Can't extend trajectory " << filename << ", skipping frames" << std::endl;
+			}
+			failed = true;
+			framesDropped += (int)block->steps.size();
+		}
+		block->steps.clear();
+
+		// Blocks carry on after the index rather than over it, so the header always points at a whole one
+		uint64_t indexBytes = index.size() * sizeof(IndexEntry);
+		if (blocksSinceIndex >= indexBlocks && bytesSinceIndex >= indexSpacing * indexBytes && WriteIndex(index, fileEnd)) {
+			fileEnd += indexBytes;
+			blocksSinceIndex = 0;
+			bytesSinceIndex = 0;
+		}
+
+		lock.lock();
+		freeBlocks.push_back(block);
+		blocksWritten++;
+	}
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include "TrajectoryCodec.h"
+#include "ThreadPool.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace NCL {
+	// Appends the position and velocity of every agent, in id order, to a file once every interval steps.
+	// Closing the recorder appends a table of where each frame starts, which the header points to. While
+	// recording, the background thread also appends the table of what it has written so far every so often
+	// and points the header at it, so a run that is killed can still be read up to there. Those tables are
+	// left behind as dead space, and are spaced out as they grow so they stay a small part of the file.
+	//
+	// With bits of 0, raw frames are copied straight into mapped extents of the file. A background thread
+	// maps the next extent ahead of time and flushes and unmaps the full ones, so recording never waits on
+	// the disk. Otherwise frames are quantised into blocks of blockFrames, which encoder threads compress
+	// with TrajectoryCodec and the background thread appends in order. Every frame of a block has the
+	// block's offset in the index.
+	//
+	// Layout: header | raw frames packed into extents whose tails may be unused, or blocks, either with earlier
+	// indexes between them | index of { step, offset }
+	class TrajectoryRecorder {
+	public:
+		static const uint32_t fileMagic = 0x544b4c46;
+		static const uint32_t fileVersion = 2;
+
+		struct FrameHeader {
+			uint64_t step;
+			int32_t count;
+			int32_t padding;
+		};
+
+		struct IndexEntry {
+			uint64_t step;
+			uint64_t offset;
+		};
+
+		struct Header {
+			uint32_t magic;
+			uint32_t version;
+			int32_t numAgents;
+			int32_t interval;
+			float maxBound;
+			float maxVelocity;
+			// 0 for raw frames
+			int32_t bits;
+			int32_t blockFrames;
+			// Both 0 until the first index is written
+			uint64_t frameCount;
+			uint64_t indexOffset;
+		};
+
+		// Returns nullptr if the file can't be created
+		static TrajectoryRecorder* Create(const std::string& filename, int numAgents, float maxBound, float maxVelocity, int interval, int bits, int blockFrames);
+		~TrajectoryRecorder();
+
+		// slots maps each agent id to where it is in agents. Does nothing unless step is due.
+		void Record(const Agent* agents, const int* slots, uint64_t step);
+
+		int FramesRecorded() const {
+			return framesRecorded;
+		}
+
+		// Frames that came before the background thread had the next extent ready, or with every block
+		// still waiting to be encoded
+		int FramesDropped() const {
+			return framesDropped;
+		}
+
+	protected:
+		struct Extent {
+			char* memory = nullptr;
+			uint64_t offset = 0;
+			size_t used = 0;
+			// The mapping handle on Windows
+			intptr_t mapping = 0;
+		};
+
+		// A block holds blockFrames x numAgents x 6 values, in narrowFrames when bits is 16 or less and frames
+		// otherwise, which is 192MB for a million agents in blocks of 16 frames at 16 bits. There are encoder
+		// count + 2 blocks, and the constructor cuts the encoders and then blockFrames until they fit a budget.
+		struct Block {
+			int number;
+			std::vector<uint64_t> steps;
+			std::vector<int32_t> frames;
+			std::vector<uint16_t> narrowFrames;
+			std::vector<char> encoded;
+		};
+
+		TrajectoryRecorder(const std::string& filename, int numAgents, float maxBound, float maxVelocity, int interval, int bits, int blockFrames);
+
+		bool Open();
+		bool WriteAt(uint64_t offset, const void* data, size_t bytes);
+		// Writes entries at offset, then the header pointing to them
+		bool WriteIndex(const std::vector<IndexEntry>& entries, uint64_t offset);
+		bool Truncate(uint64_t bytes);
+		Extent MapExtent(uint64_t offset);
+		void UnmapExtent(Extent& extent, bool flush);
+
+		void FlushLoop();
+
+		void RecordBlock(const Agent* agents, const int* slots, uint64_t step);
+		void SubmitBlock();
+		void WriteLoop();
+		Header MakeHeader() const;
+
+		std::string filename;
+		int numAgents;
+		float maxBound;
+		float maxVelocity;
+		int interval;
+		int bits;
+		int blockFrames;
+		int encoderCount;
+
+		size_t frameBytes;
+		size_t extentBytes;
+
+		// The file handle on Windows, the descriptor elsewhere
+		intptr_t file;
+
+		// Only touched by whoever records
+		Extent current;
+		Block* filling;
+		int blocksSubmitted;
+
+		// Appended to by whoever records raw frames, or the background thread writing blocks
+		std::vector<IndexEntry> index;
+		uint64_t fileEnd;
+
+		// Only created when compressing
+		TrajectoryCodec* codec;
+		ThreadPool* encoders;
+		ThreadPool::TaskGroup encoding;
+		std::vector<Block*> blocks;
+
+		// Handed between the recorder and the flush thread under mutex
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::vector<Extent> retired;
+		Extent next;
+		bool nextReady;
+		bool mapFailed;
+		bool running;
+		uint64_t nextOffset;
+		std::vector<Block*> freeBlocks;
+		std::map<int, Block*> encodedBlocks;
+		int blocksWritten;
+		std::thread flushThread;
+
+		std::atomic<int> framesRecorded;
+		std::atomic<int> framesDropped;
+	};
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+
+namespace NCL {
+	// Single producer, single consumer handoff of the latest value. The writer always has a buffer to
+	// fill and the reader always has a complete one to read, so neither side ever waits for the other.
+	// Buffers the reader skips over are simply overwritten.
+	template <typename T>
+	class TripleBuffer {
+	public:
+		TripleBuffer() : shared(1), writeIndex(0), readIndex(2) {}
+
+		// Direct access to every buffer, only for setting them up before the threads start
+		T& Buffer(int index) {
+			return buffers[index];
+		}
+
+		T& WriteBuffer() {
+			return buffers[writeIndex];
+		}
+
+		// Hands the filled write buffer to the reader and takes back whichever buffer was spare
+		void Publish() {
+			int previous = shared.exchange(writeIndex | freshBit, std::memory_order_acq_rel);
+			writeIndex = previous & indexMask;
+		}
+
+		// Swaps in the most recently published buffer. Returns false, and keeps the current
+		// read buffer, if nothing has been published since the last call.
+		bool Acquire() {
+			if ((shared.load(std::memory_order_relaxed) & freshBit) == 0) {
+				return false;
+			}
+			int previous = shared.exchange(readIndex, std::memory_order_acq_rel);
+			readIndex = previous & indexMask;
+			return true;
+		}
+
+		const T& ReadBuffer() const {
+			return buffers[readIndex];
+		}
+
+	protected:
+		static const int indexMask = 3;
+		static const int freshBit = 4;
+
+		T buffers[3];
+
+		// Index of the spare buffer, plus freshBit when it holds a value the reader hasn't seen
+		std::atomic<int> shared;
+		int writeIndex;
+		int readIndex;
+	};
+}
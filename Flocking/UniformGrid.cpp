@@ -0,0 +1,153 @@
+#include "UniformGrid.h"
+#include <algorithm>
+
+using namespace NCL;
+
+namespace {
+	const int agentGrain = 16384;
+	// Buckets of 8192 cells, so a bucket's cell counts fit in L1 while it sorts
+	const int bucketShift = 13;
+}
+
+UniformGrid::UniformGrid() {
+	maxBound = 0;
+	cellDimensionReciprocal = 0;
+	cellsPerAxis = 0;
+	cellCount = 0;
+
+	cellCounts = nullptr;
+	cellStart = nullptr;
+}
+
+UniformGrid::~UniformGrid() {
+	delete[] cellCounts;
+	delete[] cellStart;
+}
+
+void UniformGrid::Init(float maxBound, float cellDimension, int maxAgents) {
+	this->maxBound = maxBound;
+	cellDimensionReciprocal = 1.0f / cellDimension;
+	cellsPerAxis = (int)(2 * maxBound * cellDimensionReciprocal) + 1;
+	cellCount = cellsPerAxis * cellsPerAxis * cellsPerAxis;
+
+	delete[] cellCounts;
+	delete[] cellStart;
+	cellCounts = new int[cellCount];
+	cellStart = new int[cellCount + 1];
+
+	agentCell.resize(maxAgents);
+	bucketedIndices.resize(maxAgents);
+	bucketedCells.resize(maxAgents);
+	indices.resize(maxAgents);
+}
+
+int UniformGrid::CellCoordinate(float value) const {
+	int coordinate = (int)((value + maxBound) * cellDimensionReciprocal);
+	return coordinate < 0 ? 0 : (coordinate >= cellsPerAxis ? cellsPerAxis - 1 : coordinate);
+}
+
+int UniformGrid::CellIndex(const Vector3& position) const {
+	return CellCoordinate(position.x) + CellCoordinate(position.y) * cellsPerAxis + CellCoordinate(position.z) * cellsPerAxis * cellsPerAxis;
+}
+
+// Buckets are contiguous ranges of cells and chunks contiguous ranges of agents, both scattered in order,
+// so the result is the same however many there are
+void UniformGrid::Build(Agent* agents, int count, ThreadPool* pool) {
+	int chunkCount = std::max(1, (count + agentGrain - 1) / agentGrain);
+	int bucketCount = ((cellCount - 1) >> bucketShift) + 1;
+	chunkCounts.resize((size_t)chunkCount * bucketCount);
+	bucketStart.resize(bucketCount + 1);
+
+	pool->ParallelFor(chunkCount, 1, [&](int begin, int end) {
+		for (int c = begin; c < end; ++c) {
+			int* counts = &chunkCounts[(size_t)c * bucketCount];
+			std::fill(counts, counts + bucketCount, 0);
+
+			int last = (c + 1) * agentGrain < count ? (c + 1) * agentGrain : count;
+			for (int i = c * agentGrain; i < last; ++i) {
+				int cell = CellIndex(agents[i].position);
+				agents[i].cell = cell;
+				agentCell[i] = cell;
+				counts[cell >> bucketShift]++;
+			}
+		}
+	});
+
+	// Bucket major, chunk minor exclusive scan, which is small enough to run serially
+	int offset = 0;
+	for (int b = 0; b < bucketCount; ++b) {
+		bucketStart[b] = offset;
+		for (int c = 0; c < chunkCount; ++c) {
+			int& chunkBucket = chunkCounts[(size_t)c * bucketCount + b];
+			int inChunk = chunkBucket;
+			chunkBucket = offset;
+			offset += inChunk;
+		}
+	}
+	bucketStart[bucketCount] = offset;
+
+	pool->ParallelFor(chunkCount, 1, [&](int begin, int end) {
+		for (int c = begin; c < end; ++c) {
+			int* cursor = &chunkCounts[(size_t)c * bucketCount];
+
+			int last = (c + 1) * agentGrain < count ? (c + 1) * agentGrain : count;
+			for (int i = c * agentGrain; i < last; ++i) {
+				int cell = agentCell[i];
+				int slot = cursor[cell >> bucketShift]++;
+				bucketedIndices[slot] = i;
+				bucketedCells[slot] = cell;
+			}
+		}
+	});
+
+	pool->ParallelFor(bucketCount, 1, [&](int begin, int end) {
+		for (int b = begin; b < end; ++b) {
+			int firstCell = b << bucketShift;
+			int lastCell = firstCell + (1 << bucketShift) < cellCount ? firstCell + (1 << bucketShift) : cellCount;
+			std::fill(cellCounts + firstCell, cellCounts + lastCell, 0);
+
+			for (int j = bucketStart[b]; j < bucketStart[b + 1]; ++j) {
+				cellCounts[bucketedCells[j]]++;
+			}
+			int running = bucketStart[b];
+			for (int cell = firstCell; cell < lastCell; ++cell) {
+				cellStart[cell] = running;
+				running += cellCounts[cell];
+				cellCounts[cell] = cellStart[cell];
+			}
+			for (int j = bucketStart[b]; j < bucketStart[b + 1]; ++j) {
+				indices[cellCounts[bucketedCells[j]]++] = bucketedIndices[j];
+			}
+		}
+	});
+	cellStart[cellCount] = count;
+}
+
+void UniformGrid::GetNeighbours(const Vector3& position, std::vector<int>& neighbours, int maxCount) const {
+	int x = CellCoordinate(position.x);
+	int y = CellCoordinate(position.y);
+	int z = CellCoordinate(position.z);
+
+	int xMin = x > 0 ? x - 1 : 0;
+	int xMax = x < cellsPerAxis - 1 ? x + 1 : x;
+	int yMin = y > 0 ? y - 1 : 0;
+	int yMax = y < cellsPerAxis - 1 ? y + 1 : y;
+	int zMin = z > 0 ? z - 1 : 0;
+	int zMax = z < cellsPerAxis - 1 ? z + 1 : z;
+
+	for (int cz = zMin; cz <= zMax; ++cz) {
+		for (int cy = yMin; cy <= yMax; ++cy) {
+			// Cells along x are adjacent in memory, so each row is one contiguous run of indices
+			int rowStart = cz * cellsPerAxis * cellsPerAxis + cy * cellsPerAxis;
+			int rowBegin = cellStart[rowStart + xMin];
+			int rowEnd = cellStart[rowStart + xMax + 1];
+
+			int room = maxCount - (int)neighbours.size();
+			if (rowEnd - rowBegin > room) {
+				neighbours.insert(neighbours.end(), indices.begin() + rowBegin, indices.begin() + rowBegin + room);
+				return;
+			}
+			neighbours.insert(neighbours.end(), indices.begin() + rowBegin, indices.begin() + rowEnd);
+		}
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "Agent.h"
+#include "ThreadPool.h"
+#include <climits>
+#include <vector>
+
+namespace NCL {
+	// CPU counterpart of the GPU grid. Agents are counting sorted into cells every step, in two levels:
+	// chunks of agents first scatter their indices into buckets of adjacent cells, then each bucket counting
+	// sorts its own agents into its own cells, whose counts fit in cache. Both levels keep agents in index
+	// order, so every cell lists its agents in index order and neighbours are summed in the same order on
+	// every run. Nothing locks, and nothing allocates once the chunk counts have reached their largest.
+	class UniformGrid {
+	public:
+		UniformGrid();
+		~UniformGrid();
+
+		// Cells are cellDimension wide and cover [-maxBound, maxBound] on each axis
+		void Init(float maxBound, float cellDimension, int maxAgents);
+		void Build(Agent* agents, int count, ThreadPool* pool);
+
+		// Indices of the agents in the 27 cells around position, which covers any radius up to cellDimension.
+		// Stops appending once neighbours holds maxCount.
+		void GetNeighbours(const Vector3& position, std::vector<int>& neighbours, int maxCount = INT_MAX) const;
+
+		int CellIndex(const Vector3& position) const;
+
+		int NumCells() const {
+			return cellCount;
+		}
+
+	protected:
+		int CellCoordinate(float value) const;
+
+		float maxBound;
+		float cellDimensionReciprocal;
+		int cellsPerAxis;
+		int cellCount;
+
+		// Each cell's count, then its write cursor while its bucket scatters
+		int* cellCounts;
+		int* cellStart;
+		// Chunk major, holding each chunk's count and then its offset within every bucket
+		std::vector<int> chunkCounts;
+		std::vector<int> bucketStart;
+
+		std::vector<int> agentCell;
+		// Agent indices and their cells, grouped by bucket
+		std::vector<int> bucketedIndices;
+		std::vector<int> bucketedCells;
+		std::vector<int> indices;
+	};
+}